@@ -0,0 +1,166 @@
+/* Host stand-in for the esp-idf-lib BMP180 driver.
+
+   Follows the datasheet measurement sequence, including the conversion
+   waits, so timing on the host resembles the real part.
+*/
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "bmp180.h"
+
+static const char *TAG = "bmp180";
+
+#define BMP180_VERSION_REG        0xD0
+#define BMP180_CONTROL_REG        0xF4
+#define BMP180_OUT_MSB_REG        0xF6
+#define BMP180_CAL_AC1_REG        0xAA
+
+#define BMP180_CHIP_ID            0x55
+#define BMP180_MEASURE_TEMP       0x2E
+#define BMP180_MEASURE_PRESS      0x34
+
+#define CHECK(x) do { esp_err_t __; if ((__ = x) != ESP_OK) return __; } while (0)
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+static esp_err_t read_reg_16(i2c_dev_t *dev, uint8_t reg, int16_t *r)
+{
+    uint8_t d[2];
+    CHECK(i2c_dev_read_reg(dev, reg, d, 2));
+    *r = (int16_t)((d[0] << 8) | d[1]);
+    return ESP_OK;
+}
+
+esp_err_t bmp180_init_desc(bmp180_dev_t *dev, i2c_port_t port, gpio_num_t sda_gpio, gpio_num_t scl_gpio)
+{
+    CHECK_ARG(dev);
+
+    dev->i2c_dev.port = port;
+    dev->i2c_dev.addr = BMP180_DEVICE_ADDRESS;
+    dev->i2c_dev.cfg.sda_io_num = sda_gpio;
+    dev->i2c_dev.cfg.scl_io_num = scl_gpio;
+    dev->i2c_dev.cfg.master.clk_speed = 400000;
+
+    return i2c_dev_create_mutex(&dev->i2c_dev);
+}
+
+esp_err_t bmp180_free_desc(bmp180_dev_t *dev)
+{
+    CHECK_ARG(dev);
+
+    return i2c_dev_delete_mutex(&dev->i2c_dev);
+}
+
+esp_err_t bmp180_is_available(i2c_dev_t *dev)
+{
+    CHECK_ARG(dev);
+
+    uint8_t id;
+    I2C_DEV_TAKE_MUTEX(dev);
+    I2C_DEV_CHECK(dev, i2c_dev_read_reg(dev, BMP180_VERSION_REG, &id, 1));
+    I2C_DEV_GIVE_MUTEX(dev);
+
+    return id == BMP180_CHIP_ID ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t bmp180_init(bmp180_dev_t *dev)
+{
+    CHECK_ARG(dev);
+
+    CHECK(bmp180_is_available(&dev->i2c_dev));
+
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+
+    int16_t *calib[] = { &dev->AC1, &dev->AC2, &dev->AC3, (int16_t *)&dev->AC4, (int16_t *)&dev->AC5,
+                         (int16_t *)&dev->AC6, &dev->B1, &dev->B2, &dev->MB, &dev->MC, &dev->MD };
+    for (size_t i = 0; i < sizeof(calib) / sizeof(calib[0]); i++) {
+        I2C_DEV_CHECK(&dev->i2c_dev, read_reg_16(&dev->i2c_dev, BMP180_CAL_AC1_REG + i * 2, calib[i]));
+    }
+
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+
+    ESP_LOGD(TAG, "AC1:=%d AC2:=%d AC3:=%d AC4:=%u AC5:=%u AC6:=%u", dev->AC1, dev->AC2, dev->AC3, dev->AC4, dev->AC5, dev->AC6);
+    ESP_LOGD(TAG, "B1:=%d B2:=%d", dev->B1, dev->B2);
+    ESP_LOGD(TAG, "MB:=%d MC:=%d MD:=%d", dev->MB, dev->MC, dev->MD);
+
+    if (dev->AC1 == 0 || dev->AC2 == 0 || dev->AC3 == 0 || dev->AC4 == 0 || dev->AC5 == 0 ||
+        dev->AC6 == 0 || dev->B1 == 0 || dev->B2 == 0 || dev->MB == 0 || dev->MC == 0 || dev->MD == 0) {
+        ESP_LOGE(TAG, "Invalid calibration data");
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t bmp180_get_uncompensated_temperature(i2c_dev_t *dev, int32_t *ut)
+{
+    uint8_t d = BMP180_MEASURE_TEMP;
+    CHECK(i2c_dev_write_reg(dev, BMP180_CONTROL_REG, &d, 1));
+    vTaskDelay(pdMS_TO_TICKS(5) + 1);
+
+    int16_t v;
+    CHECK(read_reg_16(dev, BMP180_OUT_MSB_REG, &v));
+    *ut = (uint16_t)v;
+    return ESP_OK;
+}
+
+static esp_err_t bmp180_get_uncompensated_pressure(i2c_dev_t *dev, bmp180_mode_t oss, uint32_t *up)
+{
+    static const uint32_t delay_ms[] = { 5, 8, 14, 26 };
+
+    uint8_t d = BMP180_MEASURE_PRESS | (oss << 6);
+    CHECK(i2c_dev_write_reg(dev, BMP180_CONTROL_REG, &d, 1));
+    vTaskDelay(pdMS_TO_TICKS(delay_ms[oss]) + 1);
+
+    uint8_t r[3];
+    CHECK(i2c_dev_read_reg(dev, BMP180_OUT_MSB_REG, r, 3));
+    *up = (((uint32_t)r[0] << 16) | ((uint32_t)r[1] << 8) | r[2]) >> (8 - oss);
+    return ESP_OK;
+}
+
+esp_err_t bmp180_measure(bmp180_dev_t *dev, float *temperature, uint32_t *pressure, bmp180_mode_t oss)
+{
+    CHECK_ARG(dev && temperature && pressure);
+
+    int32_t t, p, ut, b3, b5, b6, x1, x2, x3;
+    uint32_t up, b4, b7;
+
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+
+    I2C_DEV_CHECK_LOGE(&dev->i2c_dev, bmp180_get_uncompensated_temperature(&dev->i2c_dev, &ut),
+                       "Could not read uncompensated temperature");
+    I2C_DEV_CHECK_LOGE(&dev->i2c_dev, bmp180_get_uncompensated_pressure(&dev->i2c_dev, oss, &up),
+                       "Could not read uncompensated pressure");
+
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+
+    x1 = ((ut - (int32_t)dev->AC6) * (int32_t)dev->AC5) >> 15;
+    x2 = ((int32_t)dev->MC << 11) / (x1 + (int32_t)dev->MD);
+    b5 = x1 + x2;
+    t = (b5 + 8) >> 4;
+    *temperature = t / 10.0f;
+
+    b6 = b5 - 4000;
+    x1 = ((int32_t)dev->B2 * ((b6 * b6) >> 12)) >> 11;
+    x2 = ((int32_t)dev->AC2 * b6) >> 11;
+    x3 = x1 + x2;
+    b3 = ((((int32_t)dev->AC1 * 4 + x3) << oss) + 2) >> 2;
+    x1 = ((int32_t)dev->AC3 * b6) >> 13;
+    x2 = ((int32_t)dev->B1 * ((b6 * b6) >> 12)) >> 16;
+    x3 = ((x1 + x2) + 2) >> 2;
+    b4 = ((uint32_t)dev->AC4 * (uint32_t)(x3 + 32768)) >> 15;
+    b7 = ((uint32_t)up - b3) * (uint32_t)(50000UL >> oss);
+
+    if (b4 == 0) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    p = (b7 < 0x80000000) ? (int32_t)((b7 * 2) / b4) : (int32_t)((b7 / b4) * 2);
+
+    x1 = (p >> 8) * (p >> 8);
+    x1 = (x1 * 3038) >> 16;
+    x2 = (-7357 * p) >> 16;
+    *pressure = p + ((x1 + x2 + (int32_t)3791) >> 4);
+
+    return ESP_OK;
+}
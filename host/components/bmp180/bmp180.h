@@ -0,0 +1,52 @@
+/* Host stand-in for the esp-idf-lib BMP180 driver.
+
+   Same descriptor layout and API as esp-idf-lib, talking to the simulated
+   BMP180 on the host I2C bus.
+*/
+#ifndef __BMP180_H__
+#define __BMP180_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <i2cdev.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMP180_DEVICE_ADDRESS 0x77
+
+typedef struct {
+    i2c_dev_t i2c_dev;
+    int16_t  AC1;
+    int16_t  AC2;
+    int16_t  AC3;
+    uint16_t AC4;
+    uint16_t AC5;
+    uint16_t AC6;
+    int16_t  B1;
+    int16_t  B2;
+    int16_t  MB;
+    int16_t  MC;
+    int16_t  MD;
+} bmp180_dev_t;
+
+typedef enum {
+    BMP180_MODE_ULTRA_LOW_POWER = 0,
+    BMP180_MODE_STANDARD,
+    BMP180_MODE_HIGH_RESOLUTION,
+    BMP180_MODE_ULTRA_HIGH_RESOLUTION
+} bmp180_mode_t;
+
+esp_err_t bmp180_init_desc(bmp180_dev_t *dev, i2c_port_t port, gpio_num_t sda_gpio, gpio_num_t scl_gpio);
+esp_err_t bmp180_free_desc(bmp180_dev_t *dev);
+esp_err_t bmp180_init(bmp180_dev_t *dev);
+esp_err_t bmp180_is_available(i2c_dev_t *dev);
+esp_err_t bmp180_measure(bmp180_dev_t *dev, float *temperature, uint32_t *pressure, bmp180_mode_t oss);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BMP180_H__ */
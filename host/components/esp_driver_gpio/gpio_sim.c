@@ -0,0 +1,153 @@
+/* Host stand-in for the ESP-IDF GPIO driver.
+
+   Pins are plain memory; there is no electrical model. Outputs are logged at
+   debug level so LED activity is visible when running the host build.
+*/
+#include <string.h>
+
+#include "esp_log.h"
+#include "driver/gpio.h"
+
+static const char *TAG = "gpio_sim";
+
+static gpio_mode_t s_mode[GPIO_NUM_MAX];
+static uint8_t s_level[GPIO_NUM_MAX];
+static gpio_int_type_t s_intr_type[GPIO_NUM_MAX];
+static gpio_isr_t s_isr[GPIO_NUM_MAX];
+static void *s_isr_arg[GPIO_NUM_MAX];
+static bool s_isr_service;
+
+static bool gpio_sim_valid(gpio_num_t gpio_num)
+{
+    return gpio_num >= 0 && gpio_num < GPIO_NUM_MAX;
+}
+
+esp_err_t gpio_config(const gpio_config_t *cfg)
+{
+    if (cfg == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (gpio_num_t pin = 0; pin < GPIO_NUM_MAX; pin++) {
+        if (cfg->pin_bit_mask & (1ULL << pin)) {
+            s_mode[pin] = cfg->mode;
+            s_intr_type[pin] = cfg->intr_type;
+            if (cfg->pull_up_en) {
+                s_level[pin] = 1;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num)
+{
+    if (!gpio_sim_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_mode[gpio_num] = GPIO_MODE_INPUT;
+    s_level[gpio_num] = 0;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    if (!gpio_sim_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_mode[gpio_num] = mode;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (!gpio_sim_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_level[gpio_num] = level ? 1 : 0;
+    ESP_LOGD(TAG, "GPIO%d -> %d", gpio_num, s_level[gpio_num]);
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    if (!gpio_sim_valid(gpio_num)) {
+        return 0;
+    }
+    return s_level[gpio_num];
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    if (!gpio_sim_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_intr_type[gpio_num] = intr_type;
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    if (s_isr_service) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_isr_service = true;
+    return ESP_OK;
+}
+
+void gpio_uninstall_isr_service(void)
+{
+    memset(s_isr, 0, sizeof(s_isr));
+    s_isr_service = false;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    if (!s_isr_service) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!gpio_sim_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_isr_arg[gpio_num] = args;
+    s_isr[gpio_num] = isr_handler;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+{
+    if (!gpio_sim_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_isr[gpio_num] = NULL;
+    return ESP_OK;
+}
+
+static bool gpio_sim_triggers(gpio_int_type_t type, uint8_t old_level, uint8_t level)
+{
+    switch (type) {
+    case GPIO_INTR_POSEDGE:
+        return !old_level && level;
+    case GPIO_INTR_NEGEDGE:
+        return old_level && !level;
+    case GPIO_INTR_ANYEDGE:
+        return old_level != level;
+    case GPIO_INTR_LOW_LEVEL:
+        return !level;
+    case GPIO_INTR_HIGH_LEVEL:
+        return level;
+    default:
+        return false;
+    }
+}
+
+void gpio_sim_drive(gpio_num_t gpio_num, uint32_t level)
+{
+    if (!gpio_sim_valid(gpio_num)) {
+        return;
+    }
+    uint8_t old_level = s_level[gpio_num];
+    s_level[gpio_num] = level ? 1 : 0;
+    if (s_isr[gpio_num] && gpio_sim_triggers(s_intr_type[gpio_num], old_level, s_level[gpio_num])) {
+        s_isr[gpio_num](s_isr_arg[gpio_num]);
+    }
+}
@@ -0,0 +1,219 @@
+/* Host stand-in for the esp-idf-lib HMC5883L driver.
+
+   Register access mirrors esp-idf-lib, against the simulated HMC5883L on the
+   host I2C bus.
+*/
+#include <string.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "hmc5883l.h"
+
+static const char *TAG = "hmc5883l";
+
+#define REG_CR_A 0x00
+#define REG_CR_B 0x01
+#define REG_MODE 0x02
+#define REG_DX_H 0x03
+#define REG_STAT 0x09
+#define REG_ID_A 0x0a
+
+#define BIT_MA  5
+#define BIT_DO  2
+#define BIT_GN  5
+
+#define MASK_MD 0x03
+#define MASK_MA 0x60
+#define MASK_DO 0x1c
+#define MASK_MS 0x03
+#define MASK_DR 0x01
+
+#define CHECK(x) do { esp_err_t __; if ((__ = x) != ESP_OK) return __; } while (0)
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+static const float gain_values [] = {
+    [HMC5883L_GAIN_1370] = 0.73,
+    [HMC5883L_GAIN_1090] = 0.92,
+    [HMC5883L_GAIN_820]  = 1.22,
+    [HMC5883L_GAIN_660]  = 1.52,
+    [HMC5883L_GAIN_440]  = 2.27,
+    [HMC5883L_GAIN_390]  = 2.56,
+    [HMC5883L_GAIN_330]  = 3.03,
+    [HMC5883L_GAIN_230]  = 4.35
+};
+
+static esp_err_t update_reg(hmc5883l_dev_t *dev, uint8_t reg, uint8_t mask, uint8_t val)
+{
+    uint8_t v;
+
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_read_reg(&dev->i2c_dev, reg, &v, 1));
+    v = (v & ~mask) | val;
+    I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_write_reg(&dev->i2c_dev, reg, &v, 1));
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+
+    return ESP_OK;
+}
+
+esp_err_t hmc5883l_init_desc(hmc5883l_dev_t *dev, i2c_port_t port, gpio_num_t sda_gpio, gpio_num_t scl_gpio)
+{
+    CHECK_ARG(dev);
+
+    dev->i2c_dev.port = port;
+    dev->i2c_dev.addr = HMC5883L_ADDR;
+    dev->i2c_dev.cfg.sda_io_num = sda_gpio;
+    dev->i2c_dev.cfg.scl_io_num = scl_gpio;
+    dev->i2c_dev.cfg.master.clk_speed = 400000;
+
+    return i2c_dev_create_mutex(&dev->i2c_dev);
+}
+
+esp_err_t hmc5883l_free_desc(hmc5883l_dev_t *dev)
+{
+    CHECK_ARG(dev);
+
+    return i2c_dev_delete_mutex(&dev->i2c_dev);
+}
+
+esp_err_t hmc5883l_init(hmc5883l_dev_t *dev)
+{
+    CHECK_ARG(dev);
+
+    uint8_t id[3];
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_read_reg(&dev->i2c_dev, REG_ID_A, id, 3));
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+
+    dev->id = id[0] | (id[1] << 8) | (id[2] << 16);
+    if (dev->id != HMC5883L_ID) {
+        ESP_LOGE(TAG, "Unknown ID: 0x%08" PRIx32 " != 0x%08x", dev->id, HMC5883L_ID);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint8_t crb;
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_read_reg(&dev->i2c_dev, REG_CR_B, &crb, 1));
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+    dev->gain = gain_values[crb >> BIT_GN];
+
+    uint8_t mode;
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_read_reg(&dev->i2c_dev, REG_MODE, &mode, 1));
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+    dev->opmode = (mode & MASK_MD) == 0 ? HMC5883L_MODE_CONTINUOUS : HMC5883L_MODE_SINGLE;
+
+    return ESP_OK;
+}
+
+esp_err_t hmc5883l_set_opmode(hmc5883l_dev_t *dev, hmc5883l_opmode_t mode)
+{
+    CHECK_ARG(dev);
+
+    uint8_t v = mode;
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_write_reg(&dev->i2c_dev, REG_MODE, &v, 1));
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+    dev->opmode = mode;
+
+    return ESP_OK;
+}
+
+esp_err_t hmc5883l_set_samples_averaged(hmc5883l_dev_t *dev, hmc5883l_samples_averaged_t samples)
+{
+    CHECK_ARG(dev);
+
+    return update_reg(dev, REG_CR_A, MASK_MA, samples << BIT_MA);
+}
+
+esp_err_t hmc5883l_set_data_rate(hmc5883l_dev_t *dev, hmc5883l_data_rate_t rate)
+{
+    CHECK_ARG(dev);
+
+    return update_reg(dev, REG_CR_A, MASK_DO, rate << BIT_DO);
+}
+
+esp_err_t hmc5883l_set_bias(hmc5883l_dev_t *dev, hmc5883l_bias_t bias)
+{
+    CHECK_ARG(dev);
+
+    return update_reg(dev, REG_CR_A, MASK_MS, bias);
+}
+
+esp_err_t hmc5883l_set_gain(hmc5883l_dev_t *dev, hmc5883l_gain_t gain)
+{
+    CHECK_ARG(dev);
+
+    uint8_t v = gain << BIT_GN;
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_write_reg(&dev->i2c_dev, REG_CR_B, &v, 1));
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+    dev->gain = gain_values[gain];
+
+    return ESP_OK;
+}
+
+esp_err_t hmc5883l_data_is_ready(hmc5883l_dev_t *dev, bool *val)
+{
+    CHECK_ARG(dev && val);
+
+    uint8_t v;
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_read_reg(&dev->i2c_dev, REG_STAT, &v, 1));
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+    *val = v & MASK_DR;
+
+    return ESP_OK;
+}
+
+esp_err_t hmc5883l_get_raw_data(hmc5883l_dev_t *dev, hmc5883l_raw_data_t *raw)
+{
+    CHECK_ARG(dev && raw);
+
+    if (dev->opmode == HMC5883L_MODE_SINGLE) {
+        /* Start a single measurement and wait for it */
+        CHECK(hmc5883l_set_opmode(dev, HMC5883L_MODE_SINGLE));
+        bool dready = false;
+        for (int i = 0; i < 10 && !dready; i++) {
+            vTaskDelay(1);
+            CHECK(hmc5883l_data_is_ready(dev, &dready));
+        }
+        if (!dready) {
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+
+    uint8_t buf[6];
+    uint8_t reg = REG_DX_H;
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_read(&dev->i2c_dev, &reg, 1, buf, 6));
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+
+    raw->x = (int16_t)((buf[0] << 8) | buf[1]);
+    raw->z = (int16_t)((buf[2] << 8) | buf[3]);
+    raw->y = (int16_t)((buf[4] << 8) | buf[5]);
+
+    return ESP_OK;
+}
+
+esp_err_t hmc5883l_raw_to_mg(const hmc5883l_dev_t *dev, const hmc5883l_raw_data_t *raw, hmc5883l_data_t *mg)
+{
+    CHECK_ARG(dev && raw && mg);
+
+    mg->x = raw->x * dev->gain;
+    mg->y = raw->y * dev->gain;
+    mg->z = raw->z * dev->gain;
+
+    return ESP_OK;
+}
+
+esp_err_t hmc5883l_get_data(hmc5883l_dev_t *dev, hmc5883l_data_t *data)
+{
+    CHECK_ARG(data);
+
+    hmc5883l_raw_data_t raw;
+    CHECK(hmc5883l_get_raw_data(dev, &raw));
+
+    return hmc5883l_raw_to_mg(dev, &raw, data);
+}
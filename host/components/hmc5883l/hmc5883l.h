@@ -0,0 +1,97 @@
+/* Host stand-in for the esp-idf-lib HMC5883L driver.
+
+   Same descriptor layout and API as esp-idf-lib, talking to the simulated
+   HMC5883L on the host I2C bus.
+*/
+#ifndef __HMC5883L_H__
+#define __HMC5883L_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <i2cdev.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HMC5883L_ADDR 0x1e
+
+#define HMC5883L_ID 0x00333448  // "H43"
+
+typedef enum {
+    HMC5883L_MODE_CONTINUOUS = 0,
+    HMC5883L_MODE_SINGLE
+} hmc5883l_opmode_t;
+
+typedef enum {
+    HMC5883L_SAMPLES_1 = 0,
+    HMC5883L_SAMPLES_2,
+    HMC5883L_SAMPLES_4,
+    HMC5883L_SAMPLES_8
+} hmc5883l_samples_averaged_t;
+
+typedef enum {
+    HMC5883L_DATA_RATE_00_75 = 0,
+    HMC5883L_DATA_RATE_01_50,
+    HMC5883L_DATA_RATE_03_00,
+    HMC5883L_DATA_RATE_07_50,
+    HMC5883L_DATA_RATE_15_00,
+    HMC5883L_DATA_RATE_30_00,
+    HMC5883L_DATA_RATE_75_00
+} hmc5883l_data_rate_t;
+
+typedef enum {
+    HMC5883L_BIAS_NORMAL = 0,
+    HMC5883L_BIAS_POSITIVE,
+    HMC5883L_BIAS_NEGATIVE
+} hmc5883l_bias_t;
+
+typedef enum {
+    HMC5883L_GAIN_1370 = 0,
+    HMC5883L_GAIN_1090,
+    HMC5883L_GAIN_820,
+    HMC5883L_GAIN_660,
+    HMC5883L_GAIN_440,
+    HMC5883L_GAIN_390,
+    HMC5883L_GAIN_330,
+    HMC5883L_GAIN_230,
+} hmc5883l_gain_t;
+
+typedef struct {
+    float x;
+    float y;
+    float z;
+} hmc5883l_data_t;
+
+typedef struct {
+    int16_t x;
+    int16_t y;
+    int16_t z;
+} hmc5883l_raw_data_t;
+
+typedef struct {
+    i2c_dev_t i2c_dev;
+    uint32_t id;
+    hmc5883l_opmode_t opmode;
+    float gain;
+} hmc5883l_dev_t;
+
+esp_err_t hmc5883l_init_desc(hmc5883l_dev_t *dev, i2c_port_t port, gpio_num_t sda_gpio, gpio_num_t scl_gpio);
+esp_err_t hmc5883l_free_desc(hmc5883l_dev_t *dev);
+esp_err_t hmc5883l_init(hmc5883l_dev_t *dev);
+esp_err_t hmc5883l_set_opmode(hmc5883l_dev_t *dev, hmc5883l_opmode_t mode);
+esp_err_t hmc5883l_set_samples_averaged(hmc5883l_dev_t *dev, hmc5883l_samples_averaged_t samples);
+esp_err_t hmc5883l_set_data_rate(hmc5883l_dev_t *dev, hmc5883l_data_rate_t rate);
+esp_err_t hmc5883l_set_bias(hmc5883l_dev_t *dev, hmc5883l_bias_t bias);
+esp_err_t hmc5883l_set_gain(hmc5883l_dev_t *dev, hmc5883l_gain_t gain);
+esp_err_t hmc5883l_data_is_ready(hmc5883l_dev_t *dev, bool *val);
+esp_err_t hmc5883l_get_raw_data(hmc5883l_dev_t *dev, hmc5883l_raw_data_t *raw);
+esp_err_t hmc5883l_raw_to_mg(const hmc5883l_dev_t *dev, const hmc5883l_raw_data_t *raw, hmc5883l_data_t *mg);
+esp_err_t hmc5883l_get_data(hmc5883l_dev_t *dev, hmc5883l_data_t *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HMC5883L_H__ */
@@ -0,0 +1,77 @@
+/* In-memory I2C bus with simulated BMP180 and HMC5883L devices.
+
+   The devices are register-level models: drivers talk to them through the
+   normal i2cdev calls, conversions take their datasheet time, and the
+   readings come from a scripted (or recorded) environment. Everything is
+   computed lazily from esp_timer_get_time(). The one exception is the
+   HMC5883L's DRDY line: with CONFIG_I2C_SIM_HMC5883L_DRDY_GPIO set, the
+   device's start hook creates the hmc5883l_drdy task, which polls the model
+   every tick and pulses the simulated GPIO when a new measurement latches.
+*/
+#ifndef I2C_SIM_H
+#define I2C_SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Physical conditions at a point in time, as "seen" by the sensors */
+typedef struct {
+    float temperature;      // degC
+    float pressure;         // Pa
+    float mag_x;            // mG, sensor frame, before hard/soft iron errors
+    float mag_y;
+    float mag_z;
+} sim_env_t;
+
+/* A register-level device model attached to the simulated bus */
+typedef struct {
+    uint8_t addr;
+    const char *name;
+    void (*reset)(void);
+    void (*start)(void);        // optional, called once the bus is initialised
+    esp_err_t (*write)(uint8_t reg, const uint8_t *data, size_t len);
+    esp_err_t (*read)(uint8_t reg, uint8_t *data, size_t len);
+} i2c_sim_device_t;
+
+/* Bus activity counters, useful when benchmarking on the host */
+typedef struct {
+    uint32_t transactions;
+    uint32_t bytes;
+    uint32_t nacks;
+    uint64_t bus_time_us;   // time the transfers would take at CONFIG_I2C_SIM_BUS_FREQ_HZ
+} i2c_sim_stats_t;
+
+extern const i2c_sim_device_t sim_bmp180_device;
+extern const i2c_sim_device_t sim_hmc5883l_device;
+
+/**
+ * @brief Load the environment script and reset all device models
+ *
+ * Called by i2cdev_init(). The script path comes from the WEATHER_SIM_SCRIPT
+ * environment variable or CONFIG_I2C_SIM_SCRIPT.
+ */
+esp_err_t i2c_sim_init(void);
+
+/**
+ * @brief Load the environment script, or select the synthetic weather
+ */
+esp_err_t sim_env_init(void);
+
+/**
+ * @brief Environment at time t_us (esp_timer time base)
+ */
+void sim_env_get(int64_t t_us, sim_env_t *env);
+
+void i2c_sim_get_stats(i2c_sim_stats_t *stats);
+void i2c_sim_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* I2C_SIM_H */
@@ -0,0 +1,224 @@
+/* Host stand-in for the esp-idf-lib i2cdev component.
+
+   Same locking model as esp-idf-lib: a mutex per device descriptor, taken by
+   drivers around multi-transaction sequences, and a mutex per port taken for
+   every single transaction.
+*/
+#include <string.h>
+
+#include "esp_log.h"
+#include "i2cdev.h"
+#include "i2c_sim.h"
+
+static const char *TAG = "i2cdev";
+
+static const i2c_sim_device_t *const s_devices[] = {
+    &sim_bmp180_device,
+    &sim_hmc5883l_device,
+};
+
+static SemaphoreHandle_t s_port_mutex[I2C_NUM_MAX];
+static i2c_sim_stats_t s_stats;
+
+static const i2c_sim_device_t *i2c_sim_find(uint8_t addr)
+{
+    for (size_t i = 0; i < sizeof(s_devices) / sizeof(s_devices[0]); i++) {
+        if (s_devices[i]->addr == addr) {
+            return s_devices[i];
+        }
+    }
+    return NULL;
+}
+
+/* Start + address + data bytes + stop, 9 clocks per byte */
+static void i2c_sim_account(size_t bytes)
+{
+    s_stats.transactions++;
+    s_stats.bytes += bytes;
+    s_stats.bus_time_us += (uint64_t)(bytes + 1) * 9 * 1000000 / CONFIG_I2C_SIM_BUS_FREQ_HZ;
+}
+
+static esp_err_t i2c_port_take(i2c_port_t port)
+{
+    if (port < 0 || port >= I2C_NUM_MAX || !s_port_mutex[port]) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!xSemaphoreTake(s_port_mutex[port], pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT))) {
+        ESP_LOGE(TAG, "Could not take port mutex %d", port);
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+esp_err_t i2cdev_init(void)
+{
+    for (int i = 0; i < I2C_NUM_MAX; i++) {
+        if (!s_port_mutex[i]) {
+            s_port_mutex[i] = xSemaphoreCreateMutex();
+            if (!s_port_mutex[i]) {
+                return ESP_ERR_NO_MEM;
+            }
+        }
+    }
+    return i2c_sim_init();
+}
+
+esp_err_t i2cdev_done(void)
+{
+    for (int i = 0; i < I2C_NUM_MAX; i++) {
+        if (s_port_mutex[i]) {
+            vSemaphoreDelete(s_port_mutex[i]);
+            s_port_mutex[i] = NULL;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t i2c_dev_create_mutex(i2c_dev_t *dev)
+{
+    if (!dev) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    dev->mutex = xSemaphoreCreateMutex();
+    if (!dev->mutex) {
+        ESP_LOGE(TAG, "[0x%02x at %d] Could not create device mutex", dev->addr, dev->port);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t i2c_dev_delete_mutex(i2c_dev_t *dev)
+{
+    if (!dev) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    vSemaphoreDelete(dev->mutex);
+    return ESP_OK;
+}
+
+esp_err_t i2c_dev_take_mutex(i2c_dev_t *dev)
+{
+    if (!dev) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!xSemaphoreTake(dev->mutex, pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT))) {
+        ESP_LOGE(TAG, "[0x%02x at %d] Could not take device mutex", dev->addr, dev->port);
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+esp_err_t i2c_dev_give_mutex(i2c_dev_t *dev)
+{
+    if (!dev) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!xSemaphoreGive(dev->mutex)) {
+        ESP_LOGE(TAG, "[0x%02x at %d] Could not give device mutex", dev->addr, dev->port);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t i2c_dev_probe(const i2c_dev_t *dev, i2c_dev_type_t operation_type)
+{
+    if (!dev) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t res = i2c_port_take(dev->port);
+    if (res != ESP_OK) {
+        return res;
+    }
+    i2c_sim_account(0);
+    res = i2c_sim_find(dev->addr) ? ESP_OK : ESP_FAIL;
+    if (res != ESP_OK) {
+        s_stats.nacks++;
+    }
+    xSemaphoreGive(s_port_mutex[dev->port]);
+    return res;
+}
+
+esp_err_t i2c_dev_read(const i2c_dev_t *dev, const void *out_data, size_t out_size, void *in_data, size_t in_size)
+{
+    if (!dev || !in_data || !in_size || (out_size && !out_data) || out_size > 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const i2c_sim_device_t *sim = i2c_sim_find(dev->addr);
+    esp_err_t res = i2c_port_take(dev->port);
+    if (res != ESP_OK) {
+        return res;
+    }
+    i2c_sim_account(out_size + in_size);
+    if (sim) {
+        uint8_t reg = out_size ? *(const uint8_t *)out_data : 0;
+        res = sim->read(reg, in_data, in_size);
+    } else {
+        s_stats.nacks++;
+        res = ESP_FAIL;
+    }
+    xSemaphoreGive(s_port_mutex[dev->port]);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Could not read from device [0x%02x at %d]: %d (%s)", dev->addr, dev->port, res, esp_err_to_name(res));
+    }
+    return res;
+}
+
+esp_err_t i2c_dev_write(const i2c_dev_t *dev, const void *out_reg, size_t out_reg_size, const void *out_data, size_t out_size)
+{
+    if (!dev || (out_reg_size && !out_reg) || (out_size && !out_data) || out_reg_size > 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const i2c_sim_device_t *sim = i2c_sim_find(dev->addr);
+    esp_err_t res = i2c_port_take(dev->port);
+    if (res != ESP_OK) {
+        return res;
+    }
+    i2c_sim_account(out_reg_size + out_size);
+    if (sim) {
+        uint8_t reg = out_reg_size ? *(const uint8_t *)out_reg : 0;
+        res = sim->write(reg, out_data, out_size);
+    } else {
+        s_stats.nacks++;
+        res = ESP_FAIL;
+    }
+    xSemaphoreGive(s_port_mutex[dev->port]);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Could not write to device [0x%02x at %d]: %d (%s)", dev->addr, dev->port, res, esp_err_to_name(res));
+    }
+    return res;
+}
+
+esp_err_t i2c_dev_read_reg(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size)
+{
+    return i2c_dev_read(dev, &reg, 1, in_data, in_size);
+}
+
+esp_err_t i2c_dev_write_reg(const i2c_dev_t *dev, uint8_t reg, const void *out_data, size_t out_size)
+{
+    return i2c_dev_write(dev, &reg, 1, out_data, out_size);
+}
+
+esp_err_t i2c_sim_init(void)
+{
+    esp_err_t res = sim_env_init();
+    for (size_t i = 0; i < sizeof(s_devices) / sizeof(s_devices[0]); i++) {
+        s_devices[i]->reset();
+    }
+    i2c_sim_reset_stats();
+    for (size_t i = 0; i < sizeof(s_devices) / sizeof(s_devices[0]); i++) {
+        if (s_devices[i]->start) {
+            s_devices[i]->start();
+        }
+    }
+    return res;
+}
+
+void i2c_sim_get_stats(i2c_sim_stats_t *stats)
+{
+    *stats = s_stats;
+}
+
+void i2c_sim_reset_stats(void)
+{
+    memset(&s_stats, 0, sizeof(s_stats));
+}
@@ -0,0 +1,99 @@
+/* Host stand-in for the esp-idf-lib i2cdev component.
+
+   Provides the same device descriptor and register access API as
+   esp-idf-lib, but transactions are routed to simulated devices on an
+   in-memory bus (see i2c_sim.h) instead of the I2C peripheral.
+*/
+#ifndef __I2CDEV_H__
+#define __I2CDEV_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CONFIG_I2CDEV_TIMEOUT
+#define CONFIG_I2CDEV_TIMEOUT 1000
+#endif
+
+typedef int i2c_port_t;
+
+#define I2C_NUM_0   0
+#define I2C_NUM_MAX 2
+
+typedef struct {
+    gpio_num_t sda_io_num;
+    gpio_num_t scl_io_num;
+    struct {
+        uint32_t clk_speed;
+    } master;
+} i2c_config_t;
+
+/**
+ * I2C device descriptor
+ */
+typedef struct {
+    i2c_port_t port;            //!< I2C port number
+    i2c_config_t cfg;           //!< I2C driver configuration
+    uint8_t addr;               //!< Unshifted address
+    SemaphoreHandle_t mutex;    //!< Device mutex
+    uint32_t timeout_ticks;     //!< Unused on the host, kept for API compatibility
+} i2c_dev_t;
+
+typedef enum {
+    I2C_DEV_WRITE = 0,
+    I2C_DEV_READ
+} i2c_dev_type_t;
+
+esp_err_t i2cdev_init(void);
+esp_err_t i2cdev_done(void);
+
+esp_err_t i2c_dev_create_mutex(i2c_dev_t *dev);
+esp_err_t i2c_dev_delete_mutex(i2c_dev_t *dev);
+esp_err_t i2c_dev_take_mutex(i2c_dev_t *dev);
+esp_err_t i2c_dev_give_mutex(i2c_dev_t *dev);
+
+esp_err_t i2c_dev_probe(const i2c_dev_t *dev, i2c_dev_type_t operation_type);
+esp_err_t i2c_dev_read(const i2c_dev_t *dev, const void *out_data, size_t out_size, void *in_data, size_t in_size);
+esp_err_t i2c_dev_write(const i2c_dev_t *dev, const void *out_reg, size_t out_reg_size, const void *out_data, size_t out_size);
+esp_err_t i2c_dev_read_reg(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size);
+esp_err_t i2c_dev_write_reg(const i2c_dev_t *dev, uint8_t reg, const void *out_data, size_t out_size);
+
+#define I2C_DEV_TAKE_MUTEX(dev) do { \
+        esp_err_t __ = i2c_dev_take_mutex(dev); \
+        if (__ != ESP_OK) return __;\
+    } while (0)
+
+#define I2C_DEV_GIVE_MUTEX(dev) do { \
+        esp_err_t __ = i2c_dev_give_mutex(dev); \
+        if (__ != ESP_OK) return __;\
+    } while (0)
+
+#define I2C_DEV_CHECK(dev, X) do { \
+        esp_err_t ___ = X; \
+        if (___ != ESP_OK) { \
+            I2C_DEV_GIVE_MUTEX(dev); \
+            return ___; \
+        } \
+    } while (0)
+
+#define I2C_DEV_CHECK_LOGE(dev, X, msg, ...) do { \
+        esp_err_t ___ = X; \
+        if (___ != ESP_OK) { \
+            I2C_DEV_GIVE_MUTEX(dev); \
+            ESP_LOGE(TAG, msg, ## __VA_ARGS__); \
+            return ___; \
+        } \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __I2CDEV_H__ */
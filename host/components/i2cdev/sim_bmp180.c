@@ -0,0 +1,190 @@
+/* Register-level model of the Bosch BMP180 pressure sensor.
+
+   Uses the calibration coefficients from the datasheet example. Raw values
+   are found by bisecting the datasheet compensation formulas, so a driver
+   compensating the raw readings gets the scripted temperature and pressure
+   back (to within the sensor's own resolution).
+*/
+#include <string.h>
+
+#include "esp_timer.h"
+#include "i2c_sim.h"
+
+#define BMP180_ADDR         0x77
+#define BMP180_REG_CALIB    0xAA
+#define BMP180_REG_ID       0xD0
+#define BMP180_REG_RESET    0xE0
+#define BMP180_REG_CTRL     0xF4
+#define BMP180_REG_OUT      0xF6
+
+#define BMP180_CHIP_ID      0x55
+#define BMP180_RESET_VALUE  0xB6
+#define BMP180_CMD_TEMP     0x2E
+#define BMP180_CMD_PRESS    0x34
+#define BMP180_CTRL_SCO     0x20
+
+static const int16_t AC1 = 408, AC2 = -72, AC3 = -14383;
+static const uint16_t AC4 = 32741, AC5 = 32757, AC6 = 23153;
+static const int16_t B1 = 6190, B2 = 4, MB = -32768, MC = -8711, MD = 2868;
+
+static struct {
+    uint8_t ctrl;
+    int64_t conv_done_us;
+    uint8_t out[3];
+    int32_t last_ut;
+} s_bmp;
+
+static int32_t bmp180_b5(int32_t ut)
+{
+    int32_t x1 = ((ut - (int32_t)AC6) * (int32_t)AC5) >> 15;
+    int32_t x2 = ((int32_t)MC << 11) / (x1 + MD);
+    return x1 + x2;
+}
+
+/* Datasheet compensation, 0.1 degC */
+static int32_t bmp180_temperature(int32_t ut)
+{
+    return (bmp180_b5(ut) + 8) >> 4;
+}
+
+/* Datasheet compensation, Pa */
+static int32_t bmp180_pressure(int32_t ut, int32_t up, int oss)
+{
+    int32_t b6 = bmp180_b5(ut) - 4000;
+    int32_t x1 = ((int32_t)B2 * ((b6 * b6) >> 12)) >> 11;
+    int32_t x2 = ((int32_t)AC2 * b6) >> 11;
+    int32_t x3 = x1 + x2;
+    int32_t b3 = ((((int32_t)AC1 * 4 + x3) << oss) + 2) >> 2;
+    x1 = ((int32_t)AC3 * b6) >> 13;
+    x2 = ((int32_t)B1 * ((b6 * b6) >> 12)) >> 16;
+    x3 = ((x1 + x2) + 2) >> 2;
+    uint32_t b4 = ((uint32_t)AC4 * (uint32_t)(x3 + 32768)) >> 15;
+    uint32_t b7 = ((uint32_t)up - b3) * (uint32_t)(50000 >> oss);
+    int32_t p = (b7 < 0x80000000) ? (int32_t)((b7 * 2) / b4) : (int32_t)((b7 / b4) * 2);
+    x1 = (p >> 8) * (p >> 8);
+    x1 = (x1 * 3038) >> 16;
+    x2 = (-7357 * p) >> 16;
+    return p + ((x1 + x2 + 3791) >> 4);
+}
+
+/* Smallest UT whose compensated temperature reaches the target */
+static int32_t bmp180_inverse_temperature(float temperature)
+{
+    int32_t target = (int32_t)(temperature * 10.0f + (temperature >= 0 ? 0.5f : -0.5f));
+    int32_t lo = 0, hi = 65535;
+    while (lo < hi) {
+        int32_t mid = (lo + hi) / 2;
+        if (bmp180_temperature(mid) < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int32_t bmp180_inverse_pressure(int32_t ut, float pressure, int oss)
+{
+    int32_t target = (int32_t)(pressure + 0.5f);
+    int32_t lo = 0, hi = (1 << (16 + oss)) - 1;
+    while (lo < hi) {
+        int32_t mid = (lo + hi) / 2;
+        if (bmp180_pressure(ut, mid, oss) < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Latch the conversion result once its conversion time has elapsed */
+static void bmp180_update(void)
+{
+    if (!(s_bmp.ctrl & BMP180_CTRL_SCO) || esp_timer_get_time() < s_bmp.conv_done_us) {
+        return;
+    }
+    s_bmp.ctrl &= ~BMP180_CTRL_SCO;
+
+    sim_env_t env;
+    sim_env_get(s_bmp.conv_done_us, &env);
+
+    if ((s_bmp.ctrl & 0x1F) == (BMP180_CMD_TEMP & 0x1F)) {
+        s_bmp.last_ut = bmp180_inverse_temperature(env.temperature);
+        s_bmp.out[0] = s_bmp.last_ut >> 8;
+        s_bmp.out[1] = s_bmp.last_ut & 0xFF;
+        s_bmp.out[2] = 0;
+    } else {
+        int oss = s_bmp.ctrl >> 6;
+        uint32_t up = (uint32_t)bmp180_inverse_pressure(s_bmp.last_ut, env.pressure, oss) << (8 - oss);
+        s_bmp.out[0] = (up >> 16) & 0xFF;
+        s_bmp.out[1] = (up >> 8) & 0xFF;
+        s_bmp.out[2] = up & 0xFF;
+    }
+}
+
+static void bmp180_reset(void)
+{
+    memset(&s_bmp, 0, sizeof(s_bmp));
+    s_bmp.out[0] = 0x80;
+    s_bmp.last_ut = bmp180_inverse_temperature(25.0f);
+}
+
+static esp_err_t bmp180_write(uint8_t reg, const uint8_t *data, size_t len)
+{
+    if (len != 1) {
+        return ESP_FAIL;
+    }
+    switch (reg) {
+    case BMP180_REG_RESET:
+        if (data[0] == BMP180_RESET_VALUE) {
+            bmp180_reset();
+        }
+        return ESP_OK;
+    case BMP180_REG_CTRL: {
+        static const int64_t press_conv_us[4] = { 4500, 7500, 13500, 25500 };
+        uint8_t cmd = data[0] & 0x1F;
+        if (cmd != (BMP180_CMD_TEMP & 0x1F) && cmd != (BMP180_CMD_PRESS & 0x1F)) {
+            return ESP_FAIL;
+        }
+        s_bmp.ctrl = data[0] | BMP180_CTRL_SCO;
+        s_bmp.conv_done_us = esp_timer_get_time() +
+                             (cmd == (BMP180_CMD_TEMP & 0x1F) ? 4500 : press_conv_us[data[0] >> 6]);
+        return ESP_OK;
+    }
+    default:
+        return ESP_FAIL;
+    }
+}
+
+static esp_err_t bmp180_read(uint8_t reg, uint8_t *data, size_t len)
+{
+    bmp180_update();
+
+    for (size_t i = 0; i < len; i++, reg++) {
+        if (reg == BMP180_REG_ID) {
+            data[i] = BMP180_CHIP_ID;
+        } else if (reg >= BMP180_REG_CALIB && reg < BMP180_REG_CALIB + 22) {
+            const uint16_t calib[11] = { (uint16_t)AC1, (uint16_t)AC2, (uint16_t)AC3, AC4, AC5, AC6,
+                                         (uint16_t)B1, (uint16_t)B2, (uint16_t)MB, (uint16_t)MC, (uint16_t)MD };
+            int off = reg - BMP180_REG_CALIB;
+            uint16_t word = calib[off / 2];
+            data[i] = (off & 1) ? (word & 0xFF) : (word >> 8);
+        } else if (reg == BMP180_REG_CTRL) {
+            data[i] = s_bmp.ctrl;
+        } else if (reg >= BMP180_REG_OUT && reg < BMP180_REG_OUT + 3) {
+            data[i] = s_bmp.out[reg - BMP180_REG_OUT];
+        } else {
+            data[i] = 0;
+        }
+    }
+    return ESP_OK;
+}
+
+const i2c_sim_device_t sim_bmp180_device = {
+    .addr = BMP180_ADDR,
+    .name = "BMP180",
+    .reset = bmp180_reset,
+    .write = bmp180_write,
+    .read = bmp180_read,
+};
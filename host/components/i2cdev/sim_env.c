@@ -0,0 +1,176 @@
+/* Scripted environment for the simulated sensors.
+
+   Either replays a CSV script (recorded or hand written), interpolating
+   between rows and looping at the end, or generates a slow synthetic
+   weather pattern with a rotating horizontal magnetic field.
+
+   The magnetometer picks up a fixed hard-iron offset and soft-iron scaling
+   here, like a sensor mounted next to steel would, so heading and
+   calibration code have something real to correct.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "i2c_sim.h"
+
+static const char *TAG = "sim_env";
+
+#define SIM_SCRIPT_MAX_ROWS 4096
+
+typedef struct {
+    int64_t t_ms;
+    sim_env_t env;
+} sim_row_t;
+
+static sim_row_t *s_rows;
+static size_t s_row_count;
+
+/* Sensor mounting errors applied to the magnetic field */
+static const float s_hard_iron[3] = { 45.0f, -30.0f, 12.0f };
+static const float s_soft_iron[3] = { 1.08f, 0.94f, 1.00f };
+
+static esp_err_t sim_env_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        ESP_LOGE(TAG, "Cannot open script %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_rows = calloc(SIM_SCRIPT_MAX_ROWS, sizeof(sim_row_t));
+    if (!s_rows) {
+        fclose(f);
+        return ESP_ERR_NO_MEM;
+    }
+
+    char line[160];
+    s_row_count = 0;
+    while (s_row_count < SIM_SCRIPT_MAX_ROWS && fgets(line, sizeof(line), f)) {
+        sim_row_t *row = &s_rows[s_row_count];
+        long long t_ms;
+        if (line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%lld,%f,%f,%f,%f,%f", &t_ms, &row->env.temperature, &row->env.pressure,
+                   &row->env.mag_x, &row->env.mag_y, &row->env.mag_z) != 6) {
+            continue;
+        }
+        if (s_row_count && t_ms <= s_rows[s_row_count - 1].t_ms) {
+            ESP_LOGW(TAG, "Skipping out of order row at %lld ms", t_ms);
+            continue;
+        }
+        row->t_ms = t_ms;
+        s_row_count++;
+    }
+    fclose(f);
+
+    if (s_row_count < 2) {
+        ESP_LOGE(TAG, "Script %s needs at least two rows", path);
+        free(s_rows);
+        s_rows = NULL;
+        s_row_count = 0;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    ESP_LOGI(TAG, "Loaded %u rows (%lld s) from %s", (unsigned)s_row_count,
+             (long long)(s_rows[s_row_count - 1].t_ms / 1000), path);
+    return ESP_OK;
+}
+
+esp_err_t sim_env_init(void)
+{
+    free(s_rows);
+    s_rows = NULL;
+    s_row_count = 0;
+
+    const char *path = getenv("WEATHER_SIM_SCRIPT");
+    if (!path || !path[0]) {
+        path = CONFIG_I2C_SIM_SCRIPT;
+    }
+    if (!path[0]) {
+        ESP_LOGI(TAG, "Using synthetic weather");
+        return ESP_OK;
+    }
+    return sim_env_load(path);
+}
+
+static float lerp(float a, float b, float f)
+{
+    return a + (b - a) * f;
+}
+
+static void sim_env_scripted(int64_t t_ms, sim_env_t *env)
+{
+    t_ms %= s_rows[s_row_count - 1].t_ms + 1;
+
+    /* Rows are few and reads are rare, a bisection keeps it cheap anyway */
+    size_t lo = 0, hi = s_row_count - 1;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (s_rows[mid].t_ms <= t_ms) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    const sim_row_t *a = &s_rows[lo];
+    const sim_row_t *b = &s_rows[hi];
+    float f = (t_ms <= a->t_ms) ? 0.0f : (float)(t_ms - a->t_ms) / (float)(b->t_ms - a->t_ms);
+    if (f > 1.0f) {
+        f = 1.0f;
+    }
+    env->temperature = lerp(a->env.temperature, b->env.temperature, f);
+    env->pressure = lerp(a->env.pressure, b->env.pressure, f);
+    env->mag_x = lerp(a->env.mag_x, b->env.mag_x, f);
+    env->mag_y = lerp(a->env.mag_y, b->env.mag_y, f);
+    env->mag_z = lerp(a->env.mag_z, b->env.mag_z, f);
+}
+
+static void sim_env_synthetic(int64_t t_ms, sim_env_t *env)
+{
+    const float two_pi = 6.28318531f;
+    float t = t_ms / 1000.0f;
+
+    env->temperature = 21.0f + 3.0f * sinf(two_pi * t / 600.0f);
+    env->pressure = 101325.0f - 250.0f * sinf(two_pi * t / 3600.0f) + 40.0f * sinf(two_pi * t / 97.0f);
+
+    /* Station slowly turning on a mast: one revolution every two minutes */
+    float heading = two_pi * t / 120.0f;
+    env->mag_x = 220.0f * cosf(heading);
+    env->mag_y = 220.0f * sinf(heading);
+    env->mag_z = -420.0f + 30.0f * sinf(two_pi * t / 45.0f);
+}
+
+#if CONFIG_I2C_SIM_NOISE
+/* Cheap deterministic noise in [-1, 1] */
+static float sim_noise(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return ((int32_t)(*state >> 8) - (1 << 23)) / (float)(1 << 23);
+}
+#endif
+
+void sim_env_get(int64_t t_us, sim_env_t *env)
+{
+    int64_t t_ms = t_us / 1000;
+    if (s_row_count) {
+        sim_env_scripted(t_ms, env);
+    } else {
+        sim_env_synthetic(t_ms, env);
+    }
+
+#if CONFIG_I2C_SIM_NOISE
+    uint32_t state = (uint32_t)(t_us / 1000) ^ 0x5bd1e995u;
+    env->temperature += 0.05f * sim_noise(&state);
+    env->pressure += 3.0f * sim_noise(&state);
+    env->mag_x += 2.0f * sim_noise(&state);
+    env->mag_y += 2.0f * sim_noise(&state);
+    env->mag_z += 2.0f * sim_noise(&state);
+#endif
+
+    env->mag_x = env->mag_x * s_soft_iron[0] + s_hard_iron[0];
+    env->mag_y = env->mag_y * s_soft_iron[1] + s_hard_iron[1];
+    env->mag_z = env->mag_z * s_soft_iron[2] + s_hard_iron[2];
+}
@@ -0,0 +1,205 @@
+/* Register-level model of the Honeywell HMC5883L magnetometer.
+
+   Continuous mode produces a new sample every 1/data-rate seconds, aligned to
+   the moment the mode register was written. Single mode produces one sample
+   after 6 ms and then returns to idle. Samples are averaged over the
+   configured number of environment readings, as the chip does internally.
+   Unread samples are overwritten by newer ones, like on the real part.
+
+   When CONFIG_I2C_SIM_HMC5883L_DRDY_GPIO is set, a helper task latches each
+   new sample as it completes and pulses that GPIO low, as the DRDY pin does.
+*/
+#include <math.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "i2c_sim.h"
+
+#define HMC5883L_ADDR       0x1E
+#define HMC5883L_REG_CRA    0x00
+#define HMC5883L_REG_CRB    0x01
+#define HMC5883L_REG_MODE   0x02
+#define HMC5883L_REG_DATA   0x03
+#define HMC5883L_REG_STATUS 0x09
+#define HMC5883L_REG_ID     0x0A
+
+#define HMC5883L_MODE_CONTINUOUS    0
+#define HMC5883L_MODE_SINGLE        1
+
+#define HMC5883L_STATUS_RDY     0x01
+
+#define HMC5883L_SINGLE_US      6000
+
+static const int64_t s_period_us[8] = { 1333333, 666667, 333333, 133333, 66667, 33333, 13333, 13333 };
+static const float s_gain_lsb_per_g[8] = { 1370, 1090, 820, 660, 440, 390, 330, 230 };
+
+static struct {
+    uint8_t regs[3];            // CRA, CRB, mode
+    int64_t start_us;           // continuous: time of sample 0; single: time of the result
+    int64_t latched;            // index of the sample in the output registers
+    int64_t consumed;           // index of the last sample whose data was read
+    uint8_t out[6];
+} s_hmc;
+
+static int16_t hmc5883l_raw(float mg, float gain)
+{
+    float raw = mg / 1000.0f * gain;
+    if (raw < -2048.0f || raw > 2047.0f) {
+        return -4096;           // overflow marker
+    }
+    return (int16_t)lrintf(raw);
+}
+
+static void hmc5883l_latch(int64_t index, int64_t t_us)
+{
+    int samples = 1 << ((s_hmc.regs[HMC5883L_REG_CRA] >> 5) & 3);
+    float gain = s_gain_lsb_per_g[s_hmc.regs[HMC5883L_REG_CRB] >> 5];
+    float x = 0, y = 0, z = 0;
+
+    /* The chip measures back to back at ~160 Hz when averaging */
+    for (int i = 0; i < samples; i++) {
+        sim_env_t env;
+        sim_env_get(t_us - i * 6250, &env);
+        x += env.mag_x;
+        y += env.mag_y;
+        z += env.mag_z;
+    }
+    int16_t raw[3] = { hmc5883l_raw(x / samples, gain), hmc5883l_raw(z / samples, gain),
+                       hmc5883l_raw(y / samples, gain) };
+    for (int i = 0; i < 3; i++) {
+        s_hmc.out[i * 2] = (uint16_t)raw[i] >> 8;
+        s_hmc.out[i * 2 + 1] = (uint16_t)raw[i] & 0xFF;
+    }
+    s_hmc.latched = index;
+}
+
+/* Index of the most recent completed sample, or -1 if none */
+static int64_t hmc5883l_current(int64_t now)
+{
+    if (now < s_hmc.start_us) {
+        return -1;
+    }
+    switch (s_hmc.regs[HMC5883L_REG_MODE] & 3) {
+    case HMC5883L_MODE_CONTINUOUS:
+        return (now - s_hmc.start_us) / s_period_us[(s_hmc.regs[HMC5883L_REG_CRA] >> 2) & 7];
+    case HMC5883L_MODE_SINGLE:
+        return 0;
+    default:
+        return s_hmc.latched;
+    }
+}
+
+static void hmc5883l_update(void)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t index = hmc5883l_current(now);
+    if (index < 0 || index == s_hmc.latched) {
+        return;
+    }
+    int64_t t_us = s_hmc.start_us;
+    if ((s_hmc.regs[HMC5883L_REG_MODE] & 3) == HMC5883L_MODE_CONTINUOUS) {
+        t_us += index * s_period_us[(s_hmc.regs[HMC5883L_REG_CRA] >> 2) & 7];
+    }
+    hmc5883l_latch(index, t_us);
+    if ((s_hmc.regs[HMC5883L_REG_MODE] & 3) == HMC5883L_MODE_SINGLE) {
+        s_hmc.regs[HMC5883L_REG_MODE] = (s_hmc.regs[HMC5883L_REG_MODE] & ~3) | 3;     // back to idle
+    }
+}
+
+static void hmc5883l_reset(void)
+{
+    memset(&s_hmc, 0, sizeof(s_hmc));
+    s_hmc.regs[HMC5883L_REG_CRA] = 0x10;
+    s_hmc.regs[HMC5883L_REG_CRB] = 0x20;
+    s_hmc.regs[HMC5883L_REG_MODE] = HMC5883L_MODE_SINGLE;
+    s_hmc.start_us = HMC5883L_SINGLE_US;
+    s_hmc.latched = -1;
+    s_hmc.consumed = -1;
+}
+
+static esp_err_t hmc5883l_write(uint8_t reg, const uint8_t *data, size_t len)
+{
+    hmc5883l_update();
+
+    for (size_t i = 0; i < len; i++, reg++) {
+        if (reg > HMC5883L_REG_MODE) {
+            return ESP_FAIL;
+        }
+        s_hmc.regs[reg] = data[i];
+        if (reg == HMC5883L_REG_MODE) {
+            int64_t now = esp_timer_get_time();
+            s_hmc.start_us = now + ((data[i] & 3) == HMC5883L_MODE_SINGLE ? HMC5883L_SINGLE_US : 0);
+            s_hmc.latched = -1;
+            s_hmc.consumed = -1;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t hmc5883l_read(uint8_t reg, uint8_t *data, size_t len)
+{
+    static const uint8_t id[3] = { 'H', '4', '3' };
+
+    hmc5883l_update();
+
+    for (size_t i = 0; i < len; i++, reg++) {
+        if (reg <= HMC5883L_REG_MODE) {
+            data[i] = s_hmc.regs[reg];
+        } else if (reg < HMC5883L_REG_STATUS) {
+            data[i] = s_hmc.out[reg - HMC5883L_REG_DATA];
+            if (reg == HMC5883L_REG_DATA + 5) {
+                s_hmc.consumed = s_hmc.latched;
+            }
+        } else if (reg == HMC5883L_REG_STATUS) {
+            /* Transfers are atomic here, so the output registers never lock */
+            data[i] = (s_hmc.latched > s_hmc.consumed) ? HMC5883L_STATUS_RDY : 0;
+        } else if (reg < HMC5883L_REG_ID + 3) {
+            data[i] = id[reg - HMC5883L_REG_ID];
+        } else {
+            data[i] = 0;
+        }
+    }
+    return ESP_OK;
+}
+
+#if CONFIG_I2C_SIM_HMC5883L_DRDY_GPIO >= 0
+/* Only one simulated task runs at a time, so this shares s_hmc with the bus */
+static void hmc5883l_drdy_task(void *arg)
+{
+    int64_t announced = -1;
+
+    gpio_sim_drive(CONFIG_I2C_SIM_HMC5883L_DRDY_GPIO, 1);
+    while (1) {
+        vTaskDelay(1);
+        hmc5883l_update();
+        if (s_hmc.latched >= 0 && s_hmc.latched != announced) {
+            announced = s_hmc.latched;
+            gpio_sim_drive(CONFIG_I2C_SIM_HMC5883L_DRDY_GPIO, 0);
+            gpio_sim_drive(CONFIG_I2C_SIM_HMC5883L_DRDY_GPIO, 1);
+        }
+    }
+}
+
+static void hmc5883l_start(void)
+{
+    static TaskHandle_t task;
+    if (!task) {
+        xTaskCreate(hmc5883l_drdy_task, "hmc5883l_drdy", 2048, NULL, 10, &task);
+    }
+}
+#endif
+
+const i2c_sim_device_t sim_hmc5883l_device = {
+    .addr = HMC5883L_ADDR,
+    .name = "HMC5883L",
+    .reset = hmc5883l_reset,
+#if CONFIG_I2C_SIM_HMC5883L_DRDY_GPIO >= 0
+    .start = hmc5883l_start,
+#endif
+    .write = hmc5883l_write,
+    .read = hmc5883l_read,
+};
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Pack the web assets into a bundle for the assets partition.
+
+The files are minified and compressed exactly as main/html_to_c.py does for
+the built-in assets, then laid out as main/asset_store.c expects: a header
+with the SHA-256 of the rest, a perfect hash slot table of the URL paths,
+one index entry per path and the strings and data. The firmware serves the
+bundle straight from mapped flash and falls back to the built-in assets
+for anything the bundle lacks.
+
+    python3 host/pack_assets.py -o assets.bin
+    python3 host/pack_assets.py --upload http://weather.local/api/assets --token SECRET
+    parttool.py write_partition --partition-name assets --input assets.bin
+
+Only the Python standard library is needed (plus brotli for --brotli).
+"""
+import argparse
+import hashlib
+import os
+import struct
+import sys
+import urllib.request
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "main"))
+import html_to_c  # noqa: E402
+
+MAGIC = 0x31424157          # "WAB1"
+HEADER = struct.Struct("<IIHBBI32s")
+ENTRY = struct.Struct("<II" + "III" * 3)
+MAX_BITS = 12
+
+
+def align(data, n=4):
+    return data + bytes(-len(data) % n)
+
+
+def pack(folder, with_brotli):
+    files = html_to_c.list_assets(folder)
+    entries = []            # (path, mime, variants)
+    report = []
+    for (i, rel_path, file_type) in files:
+        source, variants = html_to_c.process_file(i, file_type, with_brotli)
+        for path in ["/" + rel_path] + html_to_c.url_aliases.get(rel_path, []):
+            entries.append((path, html_to_c.mime_types[file_type], variants))
+        report.append((rel_path, len(source), len(variants[""]), len(variants["_gz"]),
+                       len(variants["_br"]) if variants["_br"] else None))
+    if not entries:
+        raise SystemExit("no assets in " + folder)
+
+    bits, seed, slots = html_to_c.perfect_hash([e[0] for e in entries])
+    if bits > MAX_BITS:
+        raise SystemExit("too many assets for one bundle")
+    table = [-1] * (1 << bits)
+    for index, slot in enumerate(slots):
+        table[slot] = index
+
+    index_offset = HEADER.size + len(align(struct.pack("<%dh" % len(table), *table)))
+    blob = bytearray()
+    blob_offset = index_offset + ENTRY.size * len(entries)
+
+    # Strings and data, each once even when several paths share them
+    placed = {}
+
+    def place(data):
+        if data not in placed:
+            placed[data] = blob_offset + len(blob)
+            blob.extend(align(data))
+        return placed[data]
+
+    def variant(data):
+        if data is None:
+            return (0, 0, 0)
+        return (place(data), len(data), place(html_to_c.make_etag(data).encode() + b"\0"))
+
+    index = bytearray()
+    for (path, mime, variants) in entries:
+        fields = [place(path.encode() + b"\0"), place(mime.encode() + b"\0")]
+        for suffix in ["", "_gz", "_br"]:
+            fields.extend(variant(variants[suffix]))
+        index.extend(ENTRY.pack(*fields))
+
+    body = align(struct.pack("<%dh" % len(table), *table)) + bytes(index) + bytes(blob)
+    header = HEADER.pack(MAGIC, HEADER.size + len(body), len(entries), bits, 0, seed,
+                         hashlib.sha256(body).digest())
+    return header + body, report
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--input", default=os.path.join(os.path.dirname(html_to_c.__file__), "web_content"),
+                        help="folder of web assets (default: main/web_content)")
+    parser.add_argument("-o", "--output", help="bundle file to write")
+    parser.add_argument("--upload", metavar="URL",
+                        help="PUT the bundle to the station, e.g. http://weather.local/api/assets")
+    parser.add_argument("--token", default=os.environ.get("WEATHER_ASSET_TOKEN"),
+                        help="CONFIG_WEATHER_ASSET_UPLOAD_TOKEN of the station (default: $WEATHER_ASSET_TOKEN)")
+    parser.add_argument("--brotli", action="store_true", help="include brotli variants")
+    args = parser.parse_args()
+    if not args.output and not args.upload:
+        parser.error("give --output, --upload or both")
+    if args.upload and not args.token:
+        parser.error("--upload needs --token")
+
+    if args.brotli and html_to_c.brotli is None:
+        raise SystemExit("--brotli needs the brotli module")
+    bundle, report = pack(args.input, args.brotli)
+    html_to_c.print_report(report, args.brotli)
+    print(f"Bundle: {len(bundle)} bytes")
+
+    if args.output:
+        with open(args.output, "wb") as f:
+            f.write(bundle)
+    if args.upload:
+        request = urllib.request.Request(args.upload, data=bundle, method="PUT",
+                                         headers={"Content-Type": "application/octet-stream",
+                                                  "Authorization": "Bearer " + args.token})
+        with urllib.request.urlopen(request, timeout=60) as response:
+            print(f"Upload: {response.status} {response.read().decode(errors='replace')}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
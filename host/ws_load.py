@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+"""Open several dashboard WebSockets at once and check they all get telemetry.
+
+Each viewer performs the /ws upgrade, optionally asking for the binary
+subprotocol, then counts the frames it receives for the run time. At the
+end every viewer must have received frames, and all viewers must be within
+a couple of frames of each other, since every sample is broadcast to every
+subscriber.
+
+Stalled viewers (--stalled) upgrade and then never read, like a dashboard
+on a dead link. They must not slow the others down: the server drops their
+oldest frames instead. The page load time during the run and the server's
+per-client queue counters (/api/clients) are printed at the end.
+
+    python3 host/ws_load.py --clients 7 --seconds 20
+    python3 host/ws_load.py --clients 7 --binary 3    # mix of encodings
+    python3 host/ws_load.py --clients 5 --stalled 2   # slow consumers
+
+Only the Python standard library is needed.
+"""
+import argparse
+import base64
+import http.client
+import os
+import socket
+import struct
+import sys
+import threading
+import time
+
+BINARY_SUBPROTOCOL = "weather.bin.v2"
+RECORD_SIZE = 36
+
+
+def connect(host, port, binary):
+    sock = socket.create_connection((host, port), timeout=5)
+    key = base64.b64encode(os.urandom(16)).decode()
+    request = (
+        "GET /ws HTTP/1.1\r\n"
+        f"Host: {host}:{port}\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        f"Sec-WebSocket-Key: {key}\r\n"
+        "Sec-WebSocket-Version: 13\r\n"
+    )
+    if binary:
+        request += f"Sec-WebSocket-Protocol: {BINARY_SUBPROTOCOL}\r\n"
+    sock.sendall((request + "\r\n").encode())
+
+    response = b""
+    while b"\r\n\r\n" not in response:
+        chunk = sock.recv(1024)
+        if not chunk:
+            raise ConnectionError("closed during handshake")
+        response += chunk
+    header, rest = response.split(b"\r\n\r\n", 1)
+    if b" 101 " not in header.split(b"\r\n")[0]:
+        raise ConnectionError(header.split(b"\r\n")[0].decode())
+    if binary and BINARY_SUBPROTOCOL.encode() not in header:
+        raise ConnectionError("server did not accept " + BINARY_SUBPROTOCOL)
+    return sock, rest
+
+
+def recv_exact(sock, buf, n):
+    while len(buf) < n:
+        chunk = sock.recv(4096)
+        if not chunk:
+            raise ConnectionError("closed")
+        buf += chunk
+    return buf[:n], buf[n:]
+
+
+class Viewer(threading.Thread):
+    def __init__(self, index, args, binary, stalled=False):
+        super().__init__(daemon=True)
+        self.index = index
+        self.args = args
+        self.binary = binary
+        self.stalled = stalled
+        self.frames = 0
+        self.bad = 0
+        self.error = None
+
+    def run(self):
+        try:
+            sock, buf = connect(self.args.host, self.args.port, self.binary)
+            if self.stalled:
+                # Shrink the receive window so the server's send buffer fills
+                sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1024)
+                time.sleep(self.args.seconds)
+                sock.close()
+                return
+            sock.settimeout(1)
+            deadline = time.monotonic() + self.args.seconds
+            while time.monotonic() < deadline:
+                try:
+                    head, buf = recv_exact(sock, buf, 2)
+                except socket.timeout:
+                    continue
+                opcode = head[0] & 0x0F
+                length = head[1] & 0x7F
+                if length == 126:
+                    ext, buf = recv_exact(sock, buf, 2)
+                    length = struct.unpack(">H", ext)[0]
+                elif length == 127:
+                    ext, buf = recv_exact(sock, buf, 8)
+                    length = struct.unpack(">Q", ext)[0]
+                payload, buf = recv_exact(sock, buf, length)
+                if opcode == 0x8:
+                    raise ConnectionError("server closed the socket")
+                if opcode == 0x1 and not self.binary:
+                    self.frames += 1
+                    self.bad += not payload.startswith(b"{")
+                elif opcode == 0x2 and self.binary:
+                    self.frames += 1
+                    self.bad += len(payload) != RECORD_SIZE or payload[0] != 2
+            sock.close()
+        except (OSError, ConnectionError) as e:
+            self.error = e
+
+
+def get(args, path):
+    start = time.monotonic()
+    conn = http.client.HTTPConnection(args.host, args.port, timeout=10)
+    conn.request("GET", path)
+    body = conn.getresponse().read()
+    conn.close()
+    return body, time.monotonic() - start
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--clients", type=int, default=7,
+                        help="concurrent viewers (the server's max_open_sockets is 7)")
+    parser.add_argument("--binary", type=int, default=0,
+                        help="how many of the viewers use the binary subprotocol")
+    parser.add_argument("--stalled", type=int, default=0,
+                        help="extra viewers that connect and never read")
+    parser.add_argument("--seconds", type=float, default=10)
+    args = parser.parse_args()
+
+    viewers = [Viewer(i, args, i < args.binary) for i in range(args.clients)]
+    stalled = [Viewer(args.clients + i, args, False, True) for i in range(args.stalled)]
+    for v in viewers + stalled:
+        v.start()
+    time.sleep(args.seconds / 2)
+    try:
+        _, page_time = get(args, "/")
+        clients, _ = get(args, "/api/clients")
+    except OSError as e:
+        page_time, clients = None, f"error: {e}".encode()
+    for v in viewers + stalled:
+        v.join()
+
+    failed = False
+    counts = [v.frames for v in viewers if v.error is None]
+    for v in viewers:
+        kind = "binary" if v.binary else "json"
+        status = f"error: {v.error}" if v.error else f"{v.frames} frames, {v.bad} malformed"
+        print(f"viewer {v.index} ({kind}): {status}")
+        failed |= v.error is not None or v.frames == 0 or v.bad > 0
+    if counts and max(counts) - min(counts) > 2:
+        print(f"uneven delivery: {min(counts)}..{max(counts)} frames")
+        failed = True
+    if page_time is None or page_time > 1:
+        failed = True
+    print(f"page load mid-run: {'failed' if page_time is None else f'{page_time * 1000:.0f} ms'}")
+    print(f"server queues mid-run: {clients.decode(errors='replace')}")
+    print("FAIL" if failed else "PASS")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
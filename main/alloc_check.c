@@ -0,0 +1,129 @@
+/* Steady state heap allocation check for CONFIG_WEATHER_ALLOC_CHECK
+
+   Counts every heap allocation through the heap component's allocation
+   hook, per task. From 30 s after boot each second in which a task not
+   listed below allocated counts as failed; the tasks are logged as they
+   allocate, and a PASS or FAIL line for the whole run every minute.
+
+   lwIP and the mdns 1.4.3 component have no allocator hook, so their
+   allocations cannot be moved to static storage and are left out of the
+   check: the lwIP (tiT), Wi-Fi driver (wifi, where received pbufs are
+   allocated) and mdns tasks are not counted, nor is a task between
+   alloc_check_exempt(true) and (false), which brackets our calls that
+   send on an lwIP socket, such as httpd_queue_work().
+*/
+#include "sdkconfig.h"
+
+#if CONFIG_WEATHER_ALLOC_CHECK
+#include <stdatomic.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "weather.h"
+
+static const char *TAG = "alloc_check";
+
+#define ALLOC_CHECK_TASKS       12
+#define ALLOC_CHECK_SETTLE_S    30
+#define ALLOC_CHECK_VERDICT_S   60
+
+// Tasks of components that allocate internally, by name
+static const char *const s_allowed[] = { "tiT", "wifi", "mdns" };
+
+static struct {
+    _Atomic(TaskHandle_t) task;
+    atomic_uint count;
+    atomic_bool exempt;
+} s_tasks[ALLOC_CHECK_TASKS];
+static atomic_uint s_other;     // before the scheduler, or the table is full
+
+// The slot of task, claiming a free one; -1 if the table is full
+static int IRAM_ATTR task_slot(TaskHandle_t task)
+{
+    for (int i = 0; i < ALLOC_CHECK_TASKS; i++) {
+        TaskHandle_t slot = atomic_load_explicit(&s_tasks[i].task, memory_order_relaxed);
+        if (slot == NULL) {
+            atomic_compare_exchange_strong(&s_tasks[i].task, &slot, task);
+            slot = atomic_load_explicit(&s_tasks[i].task, memory_order_relaxed);
+        }
+        if (slot == task) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    int i = task ? task_slot(task) : -1;
+
+    if (i < 0) {
+        atomic_fetch_add_explicit(&s_other, 1, memory_order_relaxed);
+    } else if (!atomic_load_explicit(&s_tasks[i].exempt, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&s_tasks[i].count, 1, memory_order_relaxed);
+    }
+}
+
+/* Leave the calling task's allocations out of the check until called with
+ * false */
+void alloc_check_exempt(bool exempt)
+{
+    int i = task_slot(xTaskGetCurrentTaskHandle());
+    if (i >= 0) {
+        atomic_store_explicit(&s_tasks[i].exempt, exempt, memory_order_relaxed);
+    }
+}
+
+static bool task_allowed(TaskHandle_t task)
+{
+    const char *name = pcTaskGetName(task);
+    for (size_t i = 0; i < sizeof(s_allowed) / sizeof(s_allowed[0]); i++) {
+        if (strcmp(name, s_allowed[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Call once a second */
+void alloc_check_report(void)
+{
+    static int seconds;
+    static int failed;
+    bool settled = ++seconds > ALLOC_CHECK_SETTLE_S;
+    bool allocated = false;
+
+    for (int i = 0; i < ALLOC_CHECK_TASKS; i++) {
+        TaskHandle_t task = atomic_load_explicit(&s_tasks[i].task, memory_order_relaxed);
+        unsigned count = atomic_exchange_explicit(&s_tasks[i].count, 0, memory_order_relaxed);
+        if (task && count && settled && !task_allowed(task)) {
+            ESP_LOGW(TAG, "%s: %u allocations in the last second", pcTaskGetName(task), count);
+            allocated = true;
+        }
+    }
+    unsigned other = atomic_exchange_explicit(&s_other, 0, memory_order_relaxed);
+    if (other && settled) {
+        ESP_LOGW(TAG, "other: %u allocations in the last second", other);
+        allocated = true;
+    }
+    if (!settled) {
+        return;
+    }
+
+    failed += allocated;
+    int checked = seconds - ALLOC_CHECK_SETTLE_S;
+    if (checked % ALLOC_CHECK_VERDICT_S == 0) {
+        if (failed) {
+            ESP_LOGE(TAG, "FAIL: heap allocations in %d of %d s", failed, checked);
+        } else {
+            ESP_LOGI(TAG, "PASS: no heap allocations in %d s", checked);
+        }
+    }
+}
+#endif // CONFIG_WEATHER_ALLOC_CHECK
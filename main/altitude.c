@@ -0,0 +1,115 @@
+/* Barometric altitude without powf()
+
+   altitude = 44330 * (1 - (p / p0)^0.190295)
+
+   The power term splits into (p / 101325)^k * (101325 / p0)^k. The first
+   factor is tabulated once at startup every 256 Pa over 30-110 kPa and
+   linearly interpolated in fixed point; the second is a single Q30 scale,
+   so changing the reference pressure costs one powf() rather than a table
+   rebuild. The interpolation error is worst at the low pressure end of the
+   table, about 5 cm, and under 1 cm above 80 kPa.
+*/
+#include <math.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#if CONFIG_WEATHER_ALTITUDE_BENCHMARK && !CONFIG_IDF_TARGET_LINUX
+#include "esp_cpu.h"
+#endif
+
+#include "sdkconfig.h"
+#include "weather.h"
+
+#define ALTITUDE_EXPONENT   0.190295
+#define ALTITUDE_SCALE_MM   44330000
+#define ALTITUDE_P_MIN      30000
+#define ALTITUDE_P_MAX      110000
+#define ALTITUDE_STEP_SHIFT 8
+#define ALTITUDE_TABLE_SIZE (((ALTITUDE_P_MAX - ALTITUDE_P_MIN) >> ALTITUDE_STEP_SHIFT) + 2)
+
+// ALTITUDE_SCALE_MM * (p / 101325)^k at each table step
+static int32_t s_table[ALTITUDE_TABLE_SIZE];
+// (101325 / p0)^k in Q30
+static uint32_t s_scale = 1u << 30;
+
+void altitude_init(void)
+{
+    for (int i = 0; i < ALTITUDE_TABLE_SIZE; i++) {
+        double p = ALTITUDE_P_MIN + (i << ALTITUDE_STEP_SHIFT);
+        s_table[i] = lround(ALTITUDE_SCALE_MM * pow(p / 101325.0, ALTITUDE_EXPONENT));
+    }
+    altitude_set_reference(REFERENCE_PRESSURE);
+}
+
+void altitude_set_reference(uint32_t p0)
+{
+    s_scale = lround((1 << 30) * pow(101325.0 / p0, ALTITUDE_EXPONENT));
+}
+
+int32_t altitude_mm(uint32_t pressure)
+{
+    if (pressure < ALTITUDE_P_MIN) {
+        pressure = ALTITUDE_P_MIN;
+    } else if (pressure > ALTITUDE_P_MAX) {
+        pressure = ALTITUDE_P_MAX;
+    }
+
+    uint32_t offset = pressure - ALTITUDE_P_MIN;
+    uint32_t i = offset >> ALTITUDE_STEP_SHIFT;
+    int32_t frac = offset & ((1 << ALTITUDE_STEP_SHIFT) - 1);
+    int32_t power = s_table[i] + (((s_table[i + 1] - s_table[i]) * frac) >> ALTITUDE_STEP_SHIFT);
+
+    return ALTITUDE_SCALE_MM - (int32_t)(((int64_t)power * s_scale) >> 30);
+}
+
+#if CONFIG_WEATHER_ALTITUDE_BENCHMARK
+static const char *TAG = "altitude";
+
+static inline uint32_t benchmark_clock(void)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    return esp_timer_get_time();
+#else
+    return esp_cpu_get_cycle_count();
+#endif
+}
+
+/* Compare altitude_mm() against powf() for speed and accuracy over the
+   table's range. Cycles on the ESP32, microseconds on the host. */
+void altitude_benchmark(void)
+{
+    const int calls = 80000;
+    volatile float sink;
+    uint32_t start;
+
+    start = benchmark_clock();
+    for (int i = 0; i < calls; i++) {
+        sink = 44330 * (1.0 - powf((ALTITUDE_P_MIN + i) / (float) REFERENCE_PRESSURE, 0.190295));
+    }
+    uint32_t powf_time = benchmark_clock() - start;
+
+    start = benchmark_clock();
+    for (int i = 0; i < calls; i++) {
+        sink = altitude_mm(ALTITUDE_P_MIN + i) / 1000.0f;
+    }
+    uint32_t table_time = benchmark_clock() - start;
+    (void)sink;
+
+    double max_error = 0;
+    for (uint32_t p = ALTITUDE_P_MIN; p <= ALTITUDE_P_MAX; p++) {
+        double exact = 44330 * (1.0 - pow(p / (double) REFERENCE_PRESSURE, ALTITUDE_EXPONENT));
+        double error = fabs(altitude_mm(p) / 1000.0 - exact);
+        if (error > max_error) {
+            max_error = error;
+        }
+    }
+
+#if CONFIG_IDF_TARGET_LINUX
+    ESP_LOGI(TAG, "powf: %.1f ns/call, table: %.1f ns/call, max error %.3f m",
+             powf_time * 1000.0 / calls, table_time * 1000.0 / calls, max_error);
+#else
+    ESP_LOGI(TAG, "powf: %lu cycles/call, table: %lu cycles/call, max error %.3f m",
+             (unsigned long)(powf_time / calls), (unsigned long)(table_time / calls), max_error);
+#endif
+}
+#endif
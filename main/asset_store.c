@@ -0,0 +1,265 @@
+/* Web assets from the assets partition
+
+   The UI can be replaced without reflashing the application: a bundle
+   built by host/pack_assets.py is written to the "assets" data partition,
+   either with parttool.py or uploaded to PUT /api/assets. At startup, and
+   after every upload, the partition is mapped into the address space and
+   checked; the assets are then served straight from the mapped flash with
+   no copy into RAM. A path the bundle lacks, or a missing or damaged
+   bundle, falls back to the assets built into the application.
+
+   Bundle layout, all little-endian and 4-byte aligned, offsets from the
+   start of the bundle:
+
+   - asset_bundle_header_t, with the SHA-256 of everything after it
+   - int16_t slots[1 << hash_bits]: the entry for each hash slot, or -1
+   - asset_bundle_entry_t entries[count]
+   - NUL-terminated paths, MIME types and ETags, and the asset data
+
+   The slots are a perfect hash of the paths with web_asset_hash() and the
+   bundle's seed, as for the built-in table, so a lookup is one hash and
+   one compare. Everything here runs in the httpd task: lookups and uploads
+   never overlap, so the mapping needs no lock.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+
+#include "sdkconfig.h"
+#include "weather.h"
+
+static const char *TAG = "asset_store";
+
+#define ASSET_PARTITION_LABEL   "assets"
+#define ASSET_BUNDLE_MAGIC      0x31424157      // "WAB1"
+#define ASSET_BUNDLE_MAX_BITS   12
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;              // whole bundle, header included
+    uint16_t count;             // entries
+    uint8_t hash_bits;
+    uint8_t reserved;
+    uint32_t hash_seed;
+    uint8_t sha256[32];         // of bytes [sizeof(header), size)
+} asset_bundle_header_t;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t len;               // 0 if the bundle has no such encoding
+    uint32_t etag;              // offset of the ETag string
+} asset_bundle_variant_t;
+
+typedef struct {
+    uint32_t path;              // offsets of strings
+    uint32_t type;
+    asset_bundle_variant_t raw;
+    asset_bundle_variant_t gz;
+    asset_bundle_variant_t br;
+} asset_bundle_entry_t;
+
+_Static_assert(sizeof(asset_bundle_header_t) == 48, "bundle header layout");
+_Static_assert(sizeof(asset_bundle_entry_t) == 44, "bundle entry layout");
+
+static const esp_partition_t *s_partition;
+static esp_partition_mmap_handle_t s_map;
+static const uint8_t *s_bundle;         // mapped partition, NULL if not mounted
+static const asset_bundle_header_t *s_header;
+static const int16_t *s_slots;
+static web_asset_t *s_assets;
+
+// Bytes being uploaded, how many have been written and erased
+static size_t s_upload_size;
+static size_t s_upload_written;
+static size_t s_upload_erased;
+
+uint32_t web_asset_hash(const char *path, size_t len, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;     // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)path[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// The NUL-terminated string at offset, or NULL if it runs past the bundle
+static const char *bundle_string(uint32_t offset)
+{
+    if (offset >= s_header->size || !memchr(s_bundle + offset, '\0', s_header->size - offset)) {
+        return NULL;
+    }
+    return (const char *)s_bundle + offset;
+}
+
+static bool bundle_variant(const asset_bundle_variant_t *in, web_variant_t *out)
+{
+    if (in->len == 0) {
+        *out = (web_variant_t) { 0 };
+        return true;
+    }
+    out->data = s_bundle + in->offset;
+    out->len = in->len;
+    out->etag = bundle_string(in->etag);
+    return in->offset < s_header->size && in->len <= s_header->size - in->offset && out->etag;
+}
+
+static void asset_store_unmount(void)
+{
+    free(s_assets);
+    s_assets = NULL;
+    if (s_bundle) {
+        esp_partition_munmap(s_map);
+        s_bundle = NULL;
+    }
+}
+
+/* Map the partition and check the bundle in it. Every offset is checked
+ * against the bundle size, so a bundle that passes can be served without
+ * further checks. */
+static esp_err_t asset_store_mount(void)
+{
+    const void *ptr;
+    esp_err_t ret = esp_partition_mmap(s_partition, 0, s_partition->size, ESP_PARTITION_MMAP_DATA, &ptr, &s_map);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot map the assets partition: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    s_bundle = ptr;
+    s_header = ptr;
+
+    const asset_bundle_header_t *h = s_header;
+    if (h->magic != ASSET_BUNDLE_MAGIC) {
+        ESP_LOGI(TAG, "No asset bundle, serving the built-in assets");
+        asset_store_unmount();
+        return ESP_ERR_NOT_FOUND;
+    }
+    size_t slots = (size_t)1 << (h->hash_bits & 31);
+    size_t index = sizeof(*h) + ((slots * sizeof(int16_t) + 3) & ~(size_t)3);
+    if (h->size > s_partition->size || h->hash_bits > ASSET_BUNDLE_MAX_BITS || h->count == 0 ||
+        index + h->count * sizeof(asset_bundle_entry_t) > h->size) {
+        ESP_LOGW(TAG, "Asset bundle is malformed, serving the built-in assets");
+        asset_store_unmount();
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t sha256[32];
+    mbedtls_sha256(s_bundle + sizeof(*h), h->size - sizeof(*h), sha256, 0);
+    if (memcmp(sha256, h->sha256, sizeof(sha256)) != 0) {
+        ESP_LOGW(TAG, "Asset bundle fails its integrity check, serving the built-in assets");
+        asset_store_unmount();
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    s_slots = (const int16_t *)(s_bundle + sizeof(*h));
+    const asset_bundle_entry_t *entries = (const asset_bundle_entry_t *)(s_bundle + index);
+    s_assets = calloc(h->count, sizeof(web_asset_t));
+    if (s_assets == NULL) {
+        asset_store_unmount();
+        return ESP_ERR_NO_MEM;
+    }
+    bool valid = true;
+    for (size_t i = 0; i < slots; i++) {
+        valid &= s_slots[i] >= -1 && s_slots[i] < h->count;
+    }
+    for (unsigned i = 0; i < h->count && valid; i++) {
+        web_asset_t *asset = &s_assets[i];
+        asset->path = bundle_string(entries[i].path);
+        asset->type = bundle_string(entries[i].type);
+        valid = asset->path && asset->type && entries[i].raw.len &&
+                bundle_variant(&entries[i].raw, &asset->raw) &&
+                bundle_variant(&entries[i].gz, &asset->gz) &&
+                bundle_variant(&entries[i].br, &asset->br);
+    }
+    if (!valid) {
+        ESP_LOGW(TAG, "Asset bundle is malformed, serving the built-in assets");
+        asset_store_unmount();
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ESP_LOGI(TAG, "Serving %u assets, %u bytes, from the assets partition", h->count, (unsigned)h->size);
+    return ESP_OK;
+}
+
+esp_err_t asset_store_init(void)
+{
+    s_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, ASSET_PARTITION_LABEL);
+    if (s_partition == NULL) {
+        ESP_LOGI(TAG, "No assets partition, serving the built-in assets");
+        return ESP_ERR_NOT_FOUND;
+    }
+    return asset_store_mount();
+}
+
+const web_asset_t *asset_store_find(const char *path, size_t len)
+{
+    if (s_assets == NULL) {
+        return NULL;
+    }
+    uint32_t hash = web_asset_hash(path, len, s_header->hash_seed);
+    int index = s_slots[hash & ((1u << s_header->hash_bits) - 1)];
+    if (index < 0) {
+        return NULL;
+    }
+    const web_asset_t *asset = &s_assets[index];
+    return strncmp(asset->path, path, len) == 0 && asset->path[len] == '\0' ? asset : NULL;
+}
+
+/* Start replacing the bundle with one of size bytes. The old bundle stops
+ * being served at once. */
+esp_err_t asset_store_begin(size_t size)
+{
+    if (s_partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (size < sizeof(asset_bundle_header_t) || size > s_partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    asset_store_unmount();
+
+    s_upload_size = size;
+    s_upload_written = 0;
+    s_upload_erased = 0;
+    return ESP_OK;
+}
+
+/* Write the next len bytes of the bundle. Each sector is erased only when
+ * the upload reaches it, so erasing keeps pace with the data received
+ * rather than holding the httpd task for seconds before the first byte. */
+esp_err_t asset_store_write(const void *data, size_t len)
+{
+    if (len > s_upload_size - s_upload_written) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t end = s_upload_written + len;
+    if (end > s_upload_erased) {
+        size_t erase = (end - s_upload_erased + s_partition->erase_size - 1) /
+                       s_partition->erase_size * s_partition->erase_size;
+        esp_err_t ret = esp_partition_erase_range(s_partition, s_upload_erased, erase);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        s_upload_erased += erase;
+    }
+    esp_err_t ret = esp_partition_write(s_partition, s_upload_written, data, len);
+    if (ret == ESP_OK) {
+        s_upload_written += len;
+    }
+    return ret;
+}
+
+/* Check the uploaded bundle as it reads back from flash and serve it. One
+ * that is short or fails the check has its header erased, so it is not
+ * tried again at the next boot, and the built-in assets are served. */
+esp_err_t asset_store_finish(void)
+{
+    esp_err_t ret = s_upload_written == s_upload_size ? asset_store_mount() : ESP_ERR_INVALID_SIZE;
+    if (ret != ESP_OK) {
+        esp_partition_erase_range(s_partition, 0, s_partition->erase_size);
+    }
+    s_upload_size = s_upload_written = s_upload_erased = 0;
+    return ret;
+}
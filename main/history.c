@@ -0,0 +1,52 @@
+/* Recent telemetry for replay
+
+   Every snapshot sent to the clients is kept here under its sequence
+   number, the one carried by its frames, so a client that reconnects can
+   ask for what it missed. The publisher task is the only producer and
+   never waits; the httpd task reads. As in sample_ring.c each slot carries
+   the sequence number it holds, cleared while the copy is in progress, so
+   a reader detects a slot that was overwritten under it. Sequence numbers
+   start at 1, and the last CONFIG_WEATHER_HISTORY_DEPTH are kept.
+*/
+#include <stdatomic.h>
+#include <string.h>
+
+#include "weather.h"
+
+typedef struct {
+    atomic_uint seq;        // 0 while being written
+    weather_data_t data;
+} history_slot_t;
+
+static history_slot_t s_slots[CONFIG_WEATHER_HISTORY_DEPTH];
+static atomic_uint s_newest;
+
+uint32_t history_append(const weather_data_t *data)
+{
+    uint32_t seq = atomic_load_explicit(&s_newest, memory_order_relaxed) + 1;
+    history_slot_t *slot = &s_slots[seq % CONFIG_WEATHER_HISTORY_DEPTH];
+
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&slot->data, data, sizeof(*data));
+    atomic_store_explicit(&slot->seq, seq, memory_order_release);
+    atomic_store_explicit(&s_newest, seq, memory_order_release);
+    return seq;
+}
+
+uint32_t history_newest(void)
+{
+    return atomic_load_explicit(&s_newest, memory_order_acquire);
+}
+
+bool history_get(uint32_t seq, weather_data_t *data)
+{
+    history_slot_t *slot = &s_slots[seq % CONFIG_WEATHER_HISTORY_DEPTH];
+
+    if (seq == 0 || atomic_load_explicit(&slot->seq, memory_order_acquire) != seq) {
+        return false;
+    }
+    memcpy(data, &slot->data, sizeof(*data));
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq;
+}
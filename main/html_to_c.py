@@ -1,22 +1,21 @@
 import os
-import requests
-import glob
-from fnmatch import fnmatch
+import gzip
+import hashlib
 import re
 
-# from css_html_js_minify import process_single_html_file, process_single_js_file, process_single_css_file, html_minify, js_minify, css_minify
-# import htmlmin
+try:
+	import brotli
+except ImportError:
+	brotli = None
 
-use_api_for_html = True  # use WEB service for HTML minify
-use_api_for_css = True # use WEB service for CSS minify
-use_api_for_js = True # use WEB service for JS minify
-
-split_lines = False # split output into multiple lines
-escape_percent = False # escape % character to %% (for printf formatting string)
+use_brotli = False # also emit brotli variants (needs the brotli module); browsers only offer br over HTTPS
 
 content_folder = "./web_content/" # input folder
 result_file = "./web_content.h" # output file
 
+# First line of the output, so an up to date file is left alone
+stamp_prefix = "// Generated by html_to_c.py from inputs "
+
 def process_text(text):
 	output = "\""
 
@@ -24,10 +23,7 @@ def process_text(text):
 		if s == '\f':
 			output += "\\f"
 		elif s == '\n':
-			if split_lines:
-				output += "\\n\"\n\""
-			else:
-				output += "\\n"
+			output += "\\n"
 		elif s == '\r':
 			output += "\\r"
 		elif s == '\t':
@@ -36,11 +32,6 @@ def process_text(text):
 			output += "\\\""
 		elif s == '\\':
 			output += "\\\\"
-		elif s == '%':
-			if escape_percent:
-				output += "%%"
-			else:
-				output += "%"
 		else:
 			output += s
 
@@ -48,130 +39,305 @@ def process_text(text):
 
 	return output
 
-def minify_html_by_api(html):
-	payload = {'input': html}
-	url = "https://www.toptal.com/developers/html-minifier/api/raw"
-	print("Requesting HTML formatting. . .")
-	r = requests.post(url, payload)
-	return r.text
-
-def minify_css_by_api(css):
-	payload = {'input': css}
-	url = "https://www.toptal.com/developers/cssminifier/api/raw"
-	print("Requesting CSS formatting. . .")
-	r = requests.post(url, payload)
-	return r.text
-
-def minify_js_by_api(js):
-	payload = {'input': js}
-	url = "https://www.toptal.com/developers/javascript-minifier/api/raw"
-	print("Requesting JS formatting. . .")
-	r = requests.post(url, payload)
-	return r.text
-
-
-# For the given path, get the List of all files in the directory tree 
+# Bytes as a C array initializer, 16 to a line
+def process_bytes(data):
+	lines = []
+	for i in range(0, len(data), 16):
+		lines.append("\t" + ", ".join("0x{0:02x}".format(b) for b in data[i:i + 16]) + ",")
+	return "{\n" + "\n".join(lines) + "\n}"
+
+# gzip with a fixed timestamp, so the same input always gives the same output
+def compress_gzip(data):
+	return gzip.compress(data, compresslevel=9, mtime=0)
+
+def compress_brotli(data):
+	return brotli.compress(data, quality=11)
+
+# Strong ETag for a representation: a quoted prefix of its SHA-256
+def make_etag(data):
+	return "\"" + hashlib.sha256(data).hexdigest()[:16] + "\""
+
+# FNV-1a of a URL path, as web_asset_find() in web_server.c computes it
+def asset_hash(path, seed):
+	h = (2166136261 ^ seed) & 0xffffffff
+	for b in path.encode("utf-8"):
+		h ^= b
+		h = (h * 16777619) & 0xffffffff
+	return h
+
+# Smallest table and seed that give every path a slot of its own
+def perfect_hash(paths):
+	bits = max(1, (2 * len(paths) - 1).bit_length())
+	while True:
+		for seed in range(1 << 16):
+			slots = [asset_hash(p, seed) & ((1 << bits) - 1) for p in paths]
+			if len(set(slots)) == len(slots):
+				return bits, seed, slots
+		bits += 1
+
+# HTML: drop comments and the whitespace between tags, collapse the rest.
+# Script, style and pre contents are kept as they are.
+def minify_html(html):
+	parts = re.split(r"(<(script|style|pre|textarea)\b.*?</\2\s*>)", html, flags=re.S | re.I)
+	output = ""
+	for i in range(0, len(parts), 3):
+		text = re.sub(r"<!--.*?-->", "", parts[i], flags=re.S)
+		text = re.sub(r">\s+<", "><", text)
+		output += re.sub(r"\s+", " ", text)
+		if i + 1 < len(parts):
+			output += parts[i + 1]
+	return output.strip()
+
+# CSS: drop comments, collapse whitespace and remove it around punctuation,
+# leaving quoted strings alone. Spaces before ':' are kept, as in
+# "a :hover" they are a descendant combinator.
+def minify_css(css):
+	parts = re.split(r"(\"(?:\\.|[^\"\\])*\"|'(?:\\.|[^'\\])*')", css)
+	output = ""
+	for i, part in enumerate(parts):
+		if i % 2:
+			output += part
+			continue
+		part = re.sub(r"/\*.*?\*/", "", part, flags=re.S)
+		part = re.sub(r"\s+", " ", part)
+		part = re.sub(r"\s*([{};,>])\s*", r"\1", part)
+		part = re.sub(r":\s+", ":", part)
+		output += part.replace(";}", "}")
+	return output.strip()
+
+# JS: drop comments and indentation and collapse whitespace. Strings,
+# template literals and regular expression literals are copied as they are.
+# Line breaks are kept (one per line) so automatic semicolon insertion
+# still sees them; that is cheap after gzip.
+def minify_js(js):
+	word = re.compile(r"[\w$]")
+	output = []
+	i = 0
+	n = len(js)
+	space = None     # whitespace seen since the last token: None, " " or "\n"
+
+	# Last character of the previous token, line breaks aside
+	def last():
+		for token in reversed(output):
+			if token != "\n":
+				return token[-1]
+		return ""
+
+	def emit(text):
+		nonlocal space
+		if space == "\n" and output:
+			output.append("\n")
+		elif space and output:
+			prev = last()
+			# A space is only needed where dropping it would join two tokens
+			if (word.match(prev) and word.match(text[0])) or prev + text[0] in ("++", "--", "//", "/*", "+-", "-+"):
+				output.append(" ")
+		space = None
+		output.append(text)
+
+	while i < n:
+		c = js[i]
+		if c in " \t\r\f\v":
+			space = space or " "
+			i += 1
+		elif c == "\n":
+			space = "\n"
+			i += 1
+		elif js.startswith("//", i):
+			i = js.find("\n", i)
+			i = n if i < 0 else i
+		elif js.startswith("/*", i):
+			end = js.find("*/", i + 2)
+			i = n if end < 0 else end + 2
+			space = space or " "
+		elif c in "'\"`":
+			j = i + 1
+			while j < n and js[j] != c:
+				j += 2 if js[j] == "\\" else 1
+			emit(js[i:j + 1])
+			i = j + 1
+		elif c == "/" and (not output or last() in "(,=:[!&|?{};+-*%<>~^" or re.search(r"\b(return|typeof|case)$", "".join(output[-3:]))):
+			# Regular expression literal, up to the unescaped closing '/' outside a class
+			j = i + 1
+			in_class = False
+			while j < n and (js[j] != "/" or in_class):
+				if js[j] == "\\":
+					j += 1
+				elif js[j] == "[":
+					in_class = True
+				elif js[j] == "]":
+					in_class = False
+				j += 1
+			j += 1
+			while j < n and word.match(js[j]):
+				j += 1
+			emit(js[i:j])
+			i = j
+		else:
+			j = i + 1
+			if word.match(c):
+				while j < n and word.match(js[j]):
+					j += 1
+			emit(js[i:j])
+			i = j
+	return "".join(output).strip()
+
+def minify_svg(svg):
+	return re.sub(r">\s+<", "><", re.sub(r"<!--.*?-->", "", svg, flags=re.S)).strip()
+
+minifiers = { "html": minify_html, "css": minify_css, "js": minify_js, "svg": minify_svg }
+mime_types = { "html": "text/html", "css": "text/css", "js": "text/javascript", "svg": "image/svg+xml" }
+
+# Most URL paths the int16_t slot table can index
+max_assets = 32767
+
+# URL paths served for each file besides its own
+url_aliases = { "index.html": ["/"] }
+
+# For the given path, get the List of all files in the directory tree
 def getListOfFiles(dirName):
-    # create a list of file and sub directories 
-    # names in the given directory 
-    print("current dir: " + os.getcwd() + ", dirName: " + dirName)
+    # create a list of file and sub directories
+    # names in the given directory
     listOfFile = os.listdir(dirName)
     allFiles = list()
     # Iterate over all the entries
     for entry in listOfFile:
         # Create full path
         fullPath = os.path.join(dirName, entry)
-        # If entry is a directory then get the list of files in this directory 
+        # If entry is a directory then get the list of files in this directory
         if os.path.isdir(fullPath):
             allFiles = allFiles + getListOfFiles(fullPath)
         else:
             allFiles.append(fullPath)
-                
+
     return allFiles
 
-# Get files 
-files_list_all = getListOfFiles(content_folder)
-print(" --- ")
-
-# Clear file
-f = open(result_file, "w")
-f.write("")
-f.close()
-
-# Statistics
-total_before_by_type = { }
-total_after_by_type = { }
-
-# Supported file types
-text_file_types = ["html", "css", "js", "svg"]
-
-# Process files 
-for i in files_list_all:
-	print("File: " + i)
-	file_type = i.split(".")[-1]
-
-	if file_type in text_file_types:
-		printed_file_name = file_type + "__" + i.replace(content_folder, "").replace("." + file_type, "").replace(".", "_").replace("\\", "_").replace("/", "_").replace("-", "")
-
-		# Read original file
-		f = open(i, "r")
-		text = f.read()
-
-		# Save length before processing
-		len_before = len(text)
-
-		if file_type == "html":
-			if (use_api_for_html):
-				text = minify_html_by_api(text)
-			else:
-				text = htmlmin.minify(text, remove_empty_space = True, remove_comments = True)
-		elif file_type == "css":
-			if (use_api_for_css):
-				text = minify_css_by_api(text)
-			else:
-				text = css_minify(text)
-		elif file_type == "js":
-			if (use_api_for_js):
-				text = minify_js_by_api(text)
-			else:
-				text = js_minify(text)
-		elif file_type == "svg":
-			text = re.sub("<!--(.*?)-->", "", text)
+# Minify and compress one file of the given type. Returns the variants by
+# suffix ("" raw, "_gz", "_br"), with None for one not generated.
+def process_file(path, file_type, with_brotli):
+	with open(path, "rb") as f:
+		source = f.read()
+	raw = minifiers[file_type](source.decode("utf-8")).encode("utf-8")
+	return source, { "": raw, "_gz": compress_gzip(raw), "_br": compress_brotli(raw) if with_brotli else None }
+
+# Every supported file under folder, in a fixed order so the output is
+# reproducible: (full path, path relative to folder, file type)
+def list_assets(folder):
+	assets = []
+	for i in sorted(getListOfFiles(folder)):
+		rel_path = os.path.relpath(i, folder).replace("\\", "/")
+		file_type = rel_path.split(".")[-1]
+		if file_type in minifiers:
+			assets.append((i, rel_path, file_type))
 		else:
-			print("Not supported type")
-		
-		len_after = len(text)
+			print("Not a supported file: " + rel_path)
+	return assets
+
+# Size report
+def ratio(size, source):
+	return "{0:5.1f}%".format(100.0 * size / source) if source else "     -"
+
+def print_report(report, with_brotli):
+	print("{0:<24} {1:>8} {2:>15} {3:>15} {4:>15}".format("Asset", "source", "minified", "gzip", "brotli"))
+	totals = [0, 0, 0, 0]
+	for (rel_path, source, minified, gz, br) in report:
+		print("{0:<24} {1:>8} {2:>8} {3} {4:>8} {5} {6:>8} {7}".format(rel_path, source,
+			minified, ratio(minified, source), gz, ratio(gz, source),
+			br if br is not None else "-", ratio(br, source) if br is not None else "      "))
+		totals = [totals[0] + source, totals[1] + minified, totals[2] + gz, totals[3] + (br or 0)]
+	print("{0:<24} {1:>8} {2:>8} {3} {4:>8} {5} {6:>8} {7}".format("Total", totals[0],
+		totals[1], ratio(totals[1], totals[0]), totals[2], ratio(totals[2], totals[0]),
+		totals[3] if with_brotli else "-", ratio(totals[3], totals[0]) if with_brotli else "      "))
+
+def brotli_available():
+	if use_brotli and brotli is None:
+		print("brotli module not found, skipping brotli variants")
+	return use_brotli and brotli is not None
+
+def main():
+	with_brotli = brotli_available()
+	files = list_assets(content_folder)
+
+	# Hash of everything the output depends on: this script, the options and
+	# every input file. When it matches the stamp in the existing output there
+	# is nothing to do, and leaving the file untouched saves a rebuild of
+	# web_server.c.
+	inputs = hashlib.sha256()
+	with open(__file__, "rb") as f:
+		inputs.update(f.read())
+	inputs.update(str(with_brotli).encode())
+	for (i, rel_path, file_type) in files:
+		inputs.update(rel_path.encode("utf-8") + b"\0")
+		with open(i, "rb") as f:
+			inputs.update(f.read())
+	stamp = stamp_prefix + inputs.hexdigest()[:16] + "\n"
+
+	if os.path.exists(result_file):
+		with open(result_file, "r") as f:
+			if f.readline() == stamp:
+				print(result_file + " is up to date")
+				return
+
+	output = [stamp]
+
+	# Table entries: URL path, C name, MIME type, variants by suffix
+	assets = []
+
+	# Size report rows: file, source, minified, gzip, brotli
+	report = []
 
-		total_after_by_type[file_type] = total_after_by_type.get(file_type, 0) + len_after
-		total_before_by_type[file_type] = total_before_by_type.get(file_type, 0) + len_before
+	for (i, rel_path, file_type) in files:
+		printed_file_name = file_type + "__" + rel_path.replace("." + file_type, "").replace(".", "_").replace("/", "_").replace("-", "")
+		source, variants = process_file(i, file_type, with_brotli)
+		raw, gz, br = variants[""], variants["_gz"], variants["_br"]
 
-		text = process_text(text)
+		# Every variant as a sized byte array, so the length is part of the
+		# declaration and no NUL terminator or escaping is involved
+		output.append("// {0}: {1} bytes, {2} minified, {3} gzip{4}\n".format(
+			rel_path, len(source), len(raw), len(gz), ", {0} brotli".format(len(br)) if br else ""))
+		for suffix in ["", "_gz", "_br"]:
+			data = variants[suffix]
+			if data is not None:
+				output.append("const unsigned char {0}{1}[{2}] = {3};\n".format(printed_file_name, suffix, len(data), process_bytes(data)))
 
-		print("Text size {0} / {1}".format(len_after, len_before))
-		print(" --- ")
+		for path in ["/" + rel_path] + url_aliases.get(rel_path, []):
+			assets.append((path, printed_file_name, mime_types[file_type], variants))
+		report.append((rel_path, len(source), len(raw), len(gz), len(br) if br else None))
 
-		# Write to result file
-		f = open(result_file, "a")
-		f.write("// Length {0} / {1}\n".format(len_after, len_before))
-		f.write("const char " + printed_file_name + "[] = "+text+";\n")
-		f.close()
-	else:
-		print("Not a text file")
+	# Asset table with a perfect hash of the URL paths, for web_asset_find().
+	# The slots are int16_t, as in a partition bundle, with -1 for empty.
+	if len(assets) > max_assets:
+		raise SystemExit("html_to_c.py: {0} asset paths, at most {1} fit the slot table".format(len(assets), max_assets))
+	bits, seed, slots = perfect_hash([a[0] for a in assets])
+	table = [-1] * (1 << bits)
+	for index, slot in enumerate(slots):
+		table[slot] = index
 
-total_before = 0
-total_after = 0
+	def variant_fields(name, data):
+		if data is None:
+			return "{ NULL, 0, NULL }"
+		return "{{ {0}, sizeof({0}), {1} }}".format(name, process_text(make_etag(data)))
 
-print()
-print("Saved space by file type: ")
+	output.append("\n#define WEB_ASSET_COUNT {0}\n".format(len(assets)))
+	output.append("static const web_asset_t web_assets[WEB_ASSET_COUNT] = {\n")
+	for (path, name, mime, variants) in assets:
+		output.append("\t{{ {0}, {1},\n\t  {2},\n\t  {3},\n\t  {4} }},\n".format(
+			process_text(path), process_text(mime),
+			variant_fields(name, variants[""]),
+			variant_fields(name + "_gz", variants["_gz"]),
+			variant_fields(name + "_br", variants["_br"])))
+	output.append("};\n")
+	output.append("#define WEB_ASSET_HASH_SEED {0}u\n".format(seed))
+	output.append("#define WEB_ASSET_HASH_BITS {0}\n".format(bits))
+	output.append("static const int16_t web_asset_slots[1 << WEB_ASSET_HASH_BITS] = {{ {0} }};\n".format(", ".join(str(t) for t in table)))
 
-for (bk, bv), (ak, av) in zip(total_before_by_type.items(), total_after_by_type.items()):
-	print(" {0}: {1} / {2} ({3})".format(bk, av, bv, (av-bv)))
-	total_before += bv
-	total_after += av
-print()
+	with open(result_file, "w", newline="\n") as f:
+		f.write("".join(output))
 
-print("Total: ")
-print(" {0} / {1} ({2})".format(total_after, total_before, (total_after-total_before)))
+	print_report(report, with_brotli)
+	print("Asset table: {0} paths in {1} slots, seed {2}".format(len(assets), 1 << bits, seed))
 
-print()
-print(" --- ")
\ No newline at end of file
+# Also imported by host/pack_assets.py, which builds the same assets into a
+# bundle for the assets partition
+if __name__ == "__main__":
+	main()
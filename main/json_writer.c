@@ -0,0 +1,136 @@
+/* Streaming JSON writer
+
+   Writes members straight into a caller supplied buffer, with no tree and
+   no allocation. Numbers are written in fixed point with a given number of
+   decimals rather than through printf("%1.15g"), which is both slow and
+   prints float noise such as 18.100000381469727. Output that does not fit
+   is dropped and reported by json_writer_finish().
+*/
+#include <math.h>
+#include <string.h>
+
+#include "weather.h"
+
+static const int64_t s_pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+static void json_put(json_writer_t *w, const char *s, size_t n)
+{
+    if (w->len + n < w->size) {
+        memcpy(w->buf + w->len, s, n);
+    }
+    w->len += n;
+}
+
+static void json_key(json_writer_t *w, const char *key)
+{
+    if (!w->first) {
+        json_put(w, ",", 1);
+    }
+    w->first = false;
+    if (key) {
+        json_put(w, "\"", 1);
+        json_put(w, key, strlen(key));
+        json_put(w, "\":", 2);
+    }
+}
+
+/* Digits of value, with a decimal point before the last decimals of them */
+static void json_digits(json_writer_t *w, int64_t value, int decimals)
+{
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    bool negative = value < 0;
+    uint64_t v = negative ? -(uint64_t)value : (uint64_t)value;
+
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+        if (--decimals == 0) {
+            *--p = '.';
+        }
+    } while (v || decimals >= 0);
+    if (negative) {
+        *--p = '-';
+    }
+    json_put(w, p, digits + sizeof(digits) - p);
+}
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->first = true;
+}
+
+void json_object_begin(json_writer_t *w, const char *key)
+{
+    json_key(w, key);
+    json_put(w, "{", 1);
+    w->first = true;
+}
+
+void json_object_end(json_writer_t *w)
+{
+    json_put(w, "}", 1);
+    w->first = false;
+}
+
+void json_array_begin(json_writer_t *w, const char *key)
+{
+    json_key(w, key);
+    json_put(w, "[", 1);
+    w->first = true;
+}
+
+void json_array_end(json_writer_t *w)
+{
+    json_put(w, "]", 1);
+    w->first = false;
+}
+
+/* value is written as is, so must not need escaping */
+void json_add_string(json_writer_t *w, const char *key, const char *value)
+{
+    json_key(w, key);
+    json_put(w, "\"", 1);
+    json_put(w, value, strlen(value));
+    json_put(w, "\"", 1);
+}
+
+void json_add_int(json_writer_t *w, const char *key, int32_t value)
+{
+    json_key(w, key);
+    json_digits(w, value, 0);
+}
+
+void json_add_uint(json_writer_t *w, const char *key, uint32_t value)
+{
+    json_key(w, key);
+    json_digits(w, value, 0);
+}
+
+void json_add_int64(json_writer_t *w, const char *key, int64_t value)
+{
+    json_key(w, key);
+    json_digits(w, value, 0);
+}
+
+void json_add_fixed(json_writer_t *w, const char *key, float value, int decimals)
+{
+    json_key(w, key);
+    if (!isfinite(value) || fabsf(value) > 1e12f) {
+        json_put(w, "null", 4);     // as cJSON does for NaN and infinity
+        return;
+    }
+    json_digits(w, llroundf(value * s_pow10[decimals]), decimals);
+}
+
+bool json_writer_finish(json_writer_t *w)
+{
+    if (w->len >= w->size) {
+        return false;
+    }
+    w->buf[w->len] = '\0';
+    return true;
+}
@@ -0,0 +1,296 @@
+/* Continuous hard/soft-iron calibration for the magnetometer
+
+   Steel near the sensor adds a fixed offset (hard iron) and stretches the
+   field along each axis (soft iron), so raw readings trace an offset,
+   axis-aligned ellipsoid instead of a sphere centred on zero. Every raw
+   sample goes through mag_cal_update(), which costs a fixed number of
+   multiply-adds whatever the history:
+
+   - running min/max per axis, to tell which axes have turned through
+     enough of the field to fit
+   - the normal equations of the least squares fit of
+       A x^2 + B y^2 + C z^2 + D x + E y + F z = 1
+     decayed by a forgetting factor so the fit follows a changed mounting
+
+   Samples closer than MAG_CAL_MIN_STEP to the last one used are skipped,
+   so a station standing still does not bury the history in one point.
+   Every MAG_CAL_SOLVE_EVERY used samples the 6x6 system is solved for the
+   centre and semi-axes. Axes that have not seen enough rotation to span
+   MAG_CAL_MIN_SPAN are left out of the fit and keep their old correction;
+   a station that only ever turns flat calibrates x and y and leaves z. A
+   fit that is singular, or implausible for iron near the sensor, is dropped
+   and the previous correction stays.
+
+   The correction is loaded from NVS at startup and written back by
+   mag_cal_save() when it has moved noticeably, at most every
+   MAG_CAL_SAVE_INTERVAL_US to spare the flash.
+*/
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "sdkconfig.h"
+#include "weather.h"
+
+static const char *TAG = "mag_cal";
+
+#define MAG_CAL_NVS_NAMESPACE   "mag_cal"
+#define MAG_CAL_NVS_KEY         "cal"
+#define MAG_CAL_UNIT            1000.0      // fit in gauss to keep the sums well scaled
+#define MAG_CAL_MIN_STEP        10.0f       // mG between samples used
+#define MAG_CAL_MIN_SPAN        200.0f      // mG of min/max span before an axis is fitted
+#define MAG_CAL_MAX_FIELD       4000.0f     // mG, anything larger is a bad read
+#define MAG_CAL_MIN_SCALE       0.5         // soft iron beyond 2:1 means a bad fit
+#define MAG_CAL_SOLVE_EVERY     50
+#define MAG_CAL_SAVE_INTERVAL_US (10 * 60 * 1000000LL)
+#define MAG_CAL_SAVE_OFFSET     2.0f        // mG change worth a flash write
+#define MAG_CAL_SAVE_SCALE      0.01f
+
+// Fit parameters are ordered x^2, y^2, z^2, x, y, z
+#define MAG_CAL_PARAMS          6
+
+typedef struct {
+    float offset[3];    // mG, subtracted first
+    float scale[3];     // then multiplied
+} mag_cal_t;
+
+static struct {
+    float min[3];
+    float max[3];
+    float last[3];
+    double m[MAG_CAL_PARAMS][MAG_CAL_PARAMS];  // upper triangle of sum(phi phi')
+    double b[MAG_CAL_PARAMS];                  // sum(phi)
+    unsigned used;
+    bool started;
+} s_fit;
+
+static mag_cal_t s_cal = { .scale = { 1, 1, 1 } };
+static mag_cal_t s_saved;
+static int64_t s_saved_time;
+static portMUX_TYPE s_cal_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void mag_cal_init(void)
+{
+    nvs_handle_t nvs;
+    size_t size = sizeof(s_cal);
+
+    if (nvs_open(MAG_CAL_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        if (nvs_get_blob(nvs, MAG_CAL_NVS_KEY, &s_cal, &size) != ESP_OK || size != sizeof(s_cal)) {
+            s_cal = (mag_cal_t) { .scale = { 1, 1, 1 } };
+        }
+        nvs_close(nvs);
+    }
+    s_saved = s_cal;
+    ESP_LOGI(TAG, "offset %.1f %.1f %.1f mG, scale %.3f %.3f %.3f",
+             s_cal.offset[0], s_cal.offset[1], s_cal.offset[2],
+             s_cal.scale[0], s_cal.scale[1], s_cal.scale[2]);
+}
+
+/* Solve n x n system a x = y in place by Gaussian elimination with
+ * partial pivoting. Returns false if it is singular. */
+static bool solve(int n, double a[MAG_CAL_PARAMS][MAG_CAL_PARAMS], double y[MAG_CAL_PARAMS])
+{
+    for (int col = 0; col < n; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < n; row++) {
+            if (fabs(a[row][col]) > fabs(a[pivot][col])) {
+                pivot = row;
+            }
+        }
+        if (fabs(a[pivot][col]) < 1e-12) {
+            return false;
+        }
+        if (pivot != col) {
+            for (int k = 0; k < n; k++) {
+                double t = a[col][k];
+                a[col][k] = a[pivot][k];
+                a[pivot][k] = t;
+            }
+            double t = y[col];
+            y[col] = y[pivot];
+            y[pivot] = t;
+        }
+        for (int row = col + 1; row < n; row++) {
+            double f = a[row][col] / a[col][col];
+            for (int k = col; k < n; k++) {
+                a[row][k] -= f * a[col][k];
+            }
+            y[row] -= f * y[col];
+        }
+    }
+    for (int row = n - 1; row >= 0; row--) {
+        for (int k = row + 1; k < n; k++) {
+            y[row] -= a[row][k] * y[k];
+        }
+        y[row] /= a[row][row];
+    }
+    return true;
+}
+
+/* Fit the ellipsoid over the axes that have seen enough rotation */
+static void mag_cal_solve(void)
+{
+    int axes[3];
+    int n_axes = 0;
+    for (int i = 0; i < 3; i++) {
+        if (s_fit.max[i] - s_fit.min[i] >= MAG_CAL_MIN_SPAN) {
+            axes[n_axes++] = i;
+        }
+    }
+    if (n_axes < 2) {
+        return;
+    }
+
+    // Reduced system over x_i^2 and x_i of the fitted axes
+    int index[MAG_CAL_PARAMS];
+    int n = 0;
+    for (int k = 0; k < n_axes; k++) {
+        index[n++] = axes[k];
+    }
+    for (int k = 0; k < n_axes; k++) {
+        index[n++] = 3 + axes[k];
+    }
+    double a[MAG_CAL_PARAMS][MAG_CAL_PARAMS];
+    double p[MAG_CAL_PARAMS];
+    for (int r = 0; r < n; r++) {
+        for (int c = 0; c < n; c++) {
+            int i = index[r] < index[c] ? index[r] : index[c];
+            int j = index[r] < index[c] ? index[c] : index[r];
+            a[r][c] = s_fit.m[i][j];
+        }
+        p[r] = s_fit.b[index[r]];
+    }
+
+    mag_cal_t cal = s_cal;
+    double centre[3];
+    double g = 1;
+    bool fitted = solve(n, a, p);
+    for (int k = 0; fitted && k < n_axes; k++) {
+        double sq = p[k];
+        double lin = p[n_axes + k];
+        centre[k] = -lin / (2 * sq) * MAG_CAL_UNIT;
+        g += lin * lin / (4 * sq);
+        fitted = sq > 0 && fabs(centre[k]) < MAG_CAL_MAX_FIELD;
+    }
+    if (!fitted) {
+        return;
+    }
+
+    double radius[3];
+    double mean = 0;
+    for (int k = 0; k < n_axes; k++) {
+        radius[k] = sqrt(g / p[k]) * MAG_CAL_UNIT;
+        mean += radius[k];
+    }
+    mean /= n_axes;
+    for (int k = 0; k < n_axes; k++) {
+        double scale = mean / radius[k];
+        if (scale < MAG_CAL_MIN_SCALE || scale > 1 / MAG_CAL_MIN_SCALE) {
+            return;     // too lopsided to be soft iron, the samples do not describe an ellipsoid yet
+        }
+        cal.offset[axes[k]] = centre[k];
+        cal.scale[axes[k]] = scale;
+    }
+
+    ESP_LOGD(TAG, "Fit over %d axes: offset %.1f %.1f %.1f mG, scale %.3f %.3f %.3f", n_axes,
+             cal.offset[0], cal.offset[1], cal.offset[2], cal.scale[0], cal.scale[1], cal.scale[2]);
+    taskENTER_CRITICAL(&s_cal_lock);
+    s_cal = cal;
+    taskEXIT_CRITICAL(&s_cal_lock);
+}
+
+void mag_cal_update(float x, float y, float z)
+{
+    const float v[3] = { x, y, z };
+    const double lambda = 1.0 - 1.0 / CONFIG_WEATHER_MAG_CAL_WINDOW;
+
+    float step = 0;
+    for (int i = 0; i < 3; i++) {
+        if (fabsf(v[i]) > MAG_CAL_MAX_FIELD) {
+            return;
+        }
+        step += fabsf(v[i] - s_fit.last[i]);
+    }
+    if (s_fit.started && step < MAG_CAL_MIN_STEP) {
+        return;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (!s_fit.started || v[i] < s_fit.min[i]) {
+            s_fit.min[i] = v[i];
+        }
+        if (!s_fit.started || v[i] > s_fit.max[i]) {
+            s_fit.max[i] = v[i];
+        }
+        s_fit.last[i] = v[i];
+    }
+    s_fit.started = true;
+
+    const double phi[MAG_CAL_PARAMS] = {
+        x * x / (MAG_CAL_UNIT * MAG_CAL_UNIT), y * y / (MAG_CAL_UNIT * MAG_CAL_UNIT),
+        z * z / (MAG_CAL_UNIT * MAG_CAL_UNIT),
+        x / MAG_CAL_UNIT, y / MAG_CAL_UNIT, z / MAG_CAL_UNIT,
+    };
+    for (int i = 0; i < MAG_CAL_PARAMS; i++) {
+        for (int j = i; j < MAG_CAL_PARAMS; j++) {
+            s_fit.m[i][j] = lambda * s_fit.m[i][j] + phi[i] * phi[j];
+        }
+        s_fit.b[i] = lambda * s_fit.b[i] + phi[i];
+    }
+
+    if (++s_fit.used % MAG_CAL_SOLVE_EVERY == 0) {
+        mag_cal_solve();
+    }
+}
+
+void mag_cal_apply(float *x, float *y, float *z)
+{
+    taskENTER_CRITICAL(&s_cal_lock);
+    mag_cal_t cal = s_cal;
+    taskEXIT_CRITICAL(&s_cal_lock);
+
+    *x = (*x - cal.offset[0]) * cal.scale[0];
+    *y = (*y - cal.offset[1]) * cal.scale[1];
+    *z = (*z - cal.offset[2]) * cal.scale[2];
+}
+
+void mag_cal_save(void)
+{
+    int64_t now = esp_timer_get_time();
+    if (s_saved_time && now - s_saved_time < MAG_CAL_SAVE_INTERVAL_US) {
+        return;
+    }
+
+    taskENTER_CRITICAL(&s_cal_lock);
+    mag_cal_t cal = s_cal;
+    taskEXIT_CRITICAL(&s_cal_lock);
+
+    bool changed = false;
+    for (int i = 0; i < 3; i++) {
+        changed |= fabsf(cal.offset[i] - s_saved.offset[i]) > MAG_CAL_SAVE_OFFSET;
+        changed |= fabsf(cal.scale[i] - s_saved.scale[i]) > MAG_CAL_SAVE_SCALE;
+    }
+    if (!changed) {
+        return;
+    }
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(MAG_CAL_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, MAG_CAL_NVS_KEY, &cal, sizeof(cal));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Saving calibration failed, err = %d", err);
+        return;
+    }
+    s_saved = cal;
+    s_saved_time = now;
+    ESP_LOGI(TAG, "Saved offset %.1f %.1f %.1f mG, scale %.3f %.3f %.3f",
+             cal.offset[0], cal.offset[1], cal.offset[2], cal.scale[0], cal.scale[1], cal.scale[2]);
+}
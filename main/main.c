@@ -11,134 +11,130 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/gpio.h"
-#include <esp_wifi.h>
 #include <esp_event.h>
 #include <esp_log.h>
 #include <esp_system.h>
 #include <nvs_flash.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include <esp_wifi.h>
 #include "esp_netif.h"
 #include "esp_eth.h"
+#endif
 #include "esp_check.h"
-#include "bmp180.h"
-#include "hmc5883l.h"
-#include "math.h"
+#include "i2cdev.h"
 
 #include "sdkconfig.h"
 #include "esp_http_server.h"
 #include "weather.h"
 
 
-volatile weather_data_t weather_data;
-
 static const char *TAG = "weather1";
 
-void bmp180_task(void *pvParameter)
+static void configure_led(void)
 {
-    static const char *TAG = "BMP180 I2C Read";
-    weather_data_t *weather_data = (weather_data_t *) pvParameter;
-
-    bmp180_dev_t dev;
-    memset(&dev, 0, sizeof(bmp180_dev_t));
-
-    ESP_ERROR_CHECK(bmp180_init_desc(&dev, 0, I2C_PIN_SDA, I2C_PIN_SCL));
-    ESP_ERROR_CHECK(bmp180_init(&dev));
-
-    while(1) {
-        esp_err_t err;
+    gpio_reset_pin(LED_GPIO);
+    gpio_set_direction(LED_GPIO, GPIO_MODE_INPUT_OUTPUT);
+}
+static void blink_led(void)
+{
+    gpio_set_level(LED_GPIO, !gpio_get_level(LED_GPIO));
+}
 
-        err = bmp180_measure(&dev, &weather_data->temperature, &weather_data->pressure, BMP180_MODE_ULTRA_HIGH_RESOLUTION);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Reading of pressure from BMP180 failed, err = %d", err);
+/* Format a sample's fields from its driver's schema */
+static void format_sample(const sensor_sample_t *sample, char *buf, size_t size)
+{
+    const sensor_driver_t *driver = sensor_drivers[sample->msg.type];
+    int len = snprintf(buf, size, "%s", driver->name);
+
+    for (int i = 0; i < driver->field_count && len < (int)size; i++) {
+        const sensor_field_t *field = &driver->fields[i];
+        const void *value = (const uint8_t *)&sample->msg + field->offset;
+        switch (field->type) {
+        case SENSOR_FIELD_FLOAT:
+            len += snprintf(buf + len, size - len, " %s %.1f %s", field->name, *(const float *)value, field->unit);
+            break;
+        case SENSOR_FIELD_UINT32:
+            len += snprintf(buf + len, size - len, " %s %lu %s", field->name,
+                            (unsigned long)*(const uint32_t *)value, field->unit);
+            break;
+        case SENSOR_FIELD_INT:
+            len += snprintf(buf + len, size - len, " %s %d %s", field->name, *(const int *)value, field->unit);
+            break;
         }
-
-        weather_data->altitude =  44330 * (1.0 - powf(weather_data->pressure / (float) REFERENCE_PRESSURE, 0.190295));
-        ESP_LOGD(TAG, "Pressure %lu Pa, Altitude %.1f m, Temperature : %.1f degC",
-                 weather_data->pressure, weather_data->altitude, weather_data->temperature);
-
-        sensor_message_t msg = {
-            .type = MSG_BMP180_DATA,
-            .data.bmp180 = {
-                .temperature = weather_data->temperature,
-                .pressure = weather_data->pressure,
-                .altitude = weather_data->altitude
-            }
-        };
-        send_sensor_data(&msg);
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
     }
 }
 
-void hmc5883l_task(void *pvParameter)
+/* Drain the sample rings into the debug log, with a count of each sensor's
+   samples (and any the logger fell too far behind to see) once a minute */
+static void log_samples(sample_reader_t readers[MSG_SENSOR_COUNT], unsigned counts[MSG_SENSOR_COUNT])
 {
-    static const char *TAG = "HMC5883L I2C Read";
-    weather_data_t *weather_data = (weather_data_t *) pvParameter;
-    hmc5883l_dev_t dev;
-    memset(&dev, 0, sizeof(hmc5883l_dev_t));
-    
-    ESP_ERROR_CHECK(hmc5883l_init_desc(&dev, 0, I2C_PIN_SDA, I2C_PIN_SCL));
-    ESP_ERROR_CHECK(hmc5883l_init(&dev));
-    ESP_ERROR_CHECK(hmc5883l_set_opmode(&dev, HMC5883L_MODE_CONTINUOUS));
-    ESP_ERROR_CHECK(hmc5883l_set_samples_averaged(&dev, HMC5883L_SAMPLES_8));
-    ESP_ERROR_CHECK(hmc5883l_set_data_rate(&dev, HMC5883L_DATA_RATE_30_00));
-    ESP_ERROR_CHECK(hmc5883l_set_gain(&dev, HMC5883L_GAIN_1370));   
-
-    while(1) {
-        esp_err_t err;
-        hmc5883l_data_t data;
-
-        err = hmc5883l_get_data(&dev, &data);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Reading of data from HMC5883L failed, err = %d", err);
+    sensor_sample_t sample;
+    char line[128];
+
+    for (int i = 0; i < MSG_SENSOR_COUNT; i++) {
+        while (sample_reader_next(&readers[i], &sample)) {
+            counts[i]++;
+            format_sample(&sample, line, sizeof(line));
+            ESP_LOGD(TAG, "%lld us: %s", (long long)sample.timestamp, line);
         }
-
-        weather_data->x = data.x;
-        weather_data->y = data.y;
-        weather_data->z = data.z;
-        weather_data->angle = atan2(data.y, data.x) * (180 / 3.14159265) + 180;
-        ESP_LOGD(TAG, "angle: %d, x: %f, y: %f, z: %f", weather_data->angle, data.x, data.y, data.z);
-
-        sensor_message_t msg = {
-            .type = MSG_HMC5883L_DATA,
-            .data.hmc5883l = {
-                .heading = weather_data->angle,
-                .x = weather_data->x,
-                .y = weather_data->y,
-                .z = weather_data->z
-            }
-        };
-        send_sensor_data(&msg);
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
     }
-}
 
-static void configure_led(void)
-{
-    gpio_reset_pin(LED_GPIO);
-    gpio_set_direction(LED_GPIO, GPIO_MODE_INPUT_OUTPUT);
-}
-static void blink_led(void)
-{
-    gpio_set_level(LED_GPIO, !gpio_get_level(LED_GPIO));
+    static int seconds;
+    if (++seconds % 60 == 0) {
+        for (int i = 0; i < MSG_SENSOR_COUNT; i++) {
+            ESP_LOGI(TAG, "%s: %u samples, %u lost", sensor_drivers[i]->name, counts[i], readers[i].lost);
+        }
+        publisher_stats_t stats;
+        publisher_get_stats(&stats);
+        ESP_LOGI(TAG, "publisher queue: %u of %u used at most, %u dropped",
+                 stats.max_queued, stats.depth, stats.dropped);
+    }
 }
 
 void app_main(void)
 {
     ESP_ERROR_CHECK(nvs_flash_init());
+#if !CONFIG_IDF_TARGET_LINUX
     ESP_ERROR_CHECK(esp_netif_init());
+#endif
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     ESP_ERROR_CHECK(i2cdev_init());
     configure_led();
-
+    altitude_init();
+    mag_cal_init();
+#if CONFIG_WEATHER_ALTITUDE_BENCHMARK
+    altitude_benchmark();
+#endif
+#if CONFIG_WEATHER_JSON_BENCHMARK
+    web_json_benchmark();
+#endif
+#if CONFIG_WEATHER_SNAPSHOT_STRESS
+    weather_snapshot_stress();
+#endif
+
+    asset_store_init();
     wifi_init_sta();
     start_webserver();
 
-    xTaskCreate(&bmp180_task, "bmp180_task", 1024*4, (void *)&weather_data, 5, NULL);
-    xTaskCreate(&hmc5883l_task, "hmc5883l_task", 1024*4, (void *)&weather_data, 5, NULL);
+    sample_reader_t readers[MSG_SENSOR_COUNT];
+    unsigned counts[MSG_SENSOR_COUNT] = { 0 };
+    for (int i = 0; i < MSG_SENSOR_COUNT; i++) {
+        sample_reader_init(&readers[i], &sensor_rings[i]);
+    }
+
+    publisher_init();
+    xTaskCreate(&publisher_task, "publisher", 1024*3, NULL, 4, NULL);
+    xTaskCreate(&sensor_bus_task, "sensor_bus", 1024*4, NULL, 5, NULL);
 
     ESP_LOGI(TAG, "End of initialization.");
 
     while (1) {
         blink_led();
+        log_samples(readers, counts);
+        mag_cal_save();
+#if CONFIG_WEATHER_ALLOC_CHECK
+        alloc_check_report();
+#endif
         vTaskDelay(1000 / portTICK_PERIOD_MS);
     }
 
@@ -0,0 +1,93 @@
+/* Telemetry publisher
+
+   Sensor readings reach the web side through a FreeRTOS queue to this
+   task, so the I2C scheduler never waits on the web server: posting is a
+   non-blocking copy, and a reading that finds the queue full is counted
+   and dropped rather than holding up the bus.
+
+   The task is the only writer of the snapshot (weather_snapshot.c). It
+   gathers what the readings changed over CONFIG_WEATHER_PUBLISH_WINDOW_MS
+   from the first change and then hands the changed fields to
+   send_sensor_data(), which serializes the frames here and leaves only the
+   socket work to the httpd task. When the web side still has frames in
+   flight the changes carry over to the next window. Every reading also
+   goes into the time-series rollups (timeseries.c).
+*/
+#include <stdatomic.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sdkconfig.h"
+#include "weather.h"
+
+static const char *TAG = "publisher";
+
+static QueueHandle_t s_queue;
+static atomic_uint s_dropped;
+static unsigned s_max_queued;
+
+void publisher_init(void)
+{
+    s_queue = xQueueCreate(CONFIG_WEATHER_PUBLISH_QUEUE_DEPTH, sizeof(sensor_sample_t));
+    ESP_ERROR_CHECK(s_queue ? ESP_OK : ESP_ERR_NO_MEM);
+}
+
+esp_err_t publisher_post(const sensor_sample_t *sample)
+{
+    if (xQueueSend(s_queue, sample, 0) != pdTRUE) {
+        if (atomic_fetch_add(&s_dropped, 1) == 0) {
+            ESP_LOGW(TAG, "Queue full, dropping readings");
+        }
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+void publisher_get_stats(publisher_stats_t *stats)
+{
+    stats->depth = CONFIG_WEATHER_PUBLISH_QUEUE_DEPTH;
+    stats->max_queued = s_max_queued;
+    stats->dropped = atomic_load(&s_dropped);
+}
+
+void publisher_task(void *pvParameter)
+{
+    const int64_t window_us = CONFIG_WEATHER_PUBLISH_WINDOW_MS * 1000LL;
+    const int64_t tick_us = 1000000 / configTICK_RATE_HZ;
+    uint32_t changed = 0;
+    int64_t deadline = 0;
+
+    while (1) {
+        TickType_t wait = portMAX_DELAY;
+        if (changed) {
+            int64_t left = deadline - esp_timer_get_time();
+            wait = left > 0 ? (left + tick_us - 1) / tick_us : 0;
+        }
+
+        sensor_sample_t sample;
+        if (xQueueReceive(s_queue, &sample, wait) == pdTRUE) {
+            unsigned queued = uxQueueMessagesWaiting(s_queue) + 1;
+            if (queued > s_max_queued) {
+                s_max_queued = queued;
+            }
+            uint32_t fields = weather_snapshot_publish(&sample.msg, sample.timestamp);
+            timeseries_add(&sample);
+            if (fields && !changed) {
+                deadline = sample.timestamp + window_us;
+            }
+            changed |= fields;
+        }
+
+        if (changed && esp_timer_get_time() >= deadline) {
+            if (send_sensor_data(changed) == ESP_ERR_NO_MEM) {
+                // Frames still in flight, try again next window
+                deadline = esp_timer_get_time() + (window_us ? window_us : tick_us);
+            } else {
+                changed = 0;
+            }
+        }
+    }
+}
@@ -0,0 +1,64 @@
+/* Per-sensor rings of timestamped samples
+
+   The bus scheduler is the only producer of each ring. Every consumer keeps
+   its own read cursor (sample_reader_t), so each producer/consumer pair is a
+   single-producer/single-consumer ring and consumers drain at their own pace.
+
+   The producer never waits. Each slot carries the index of the sample it
+   holds, written before (index) and after (index + 1) the copy, so a reader
+   detects a slot the producer lapped it on, counts the loss and moves on.
+   Nothing is lost unless a reader falls more than
+   CONFIG_WEATHER_SAMPLE_RING_DEPTH samples behind.
+*/
+#include <string.h>
+
+#include "weather.h"
+
+sample_ring_t sensor_rings[MSG_SENSOR_COUNT];
+
+void sample_ring_push(sample_ring_t *ring, const sensor_sample_t *sample)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    sample_slot_t *slot = &ring->slots[head % CONFIG_WEATHER_SAMPLE_RING_DEPTH];
+
+    atomic_store_explicit(&slot->seq, head, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&slot->sample, sample, sizeof(*sample));
+    atomic_store_explicit(&slot->seq, head + 1, memory_order_release);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void sample_reader_init(sample_reader_t *reader, sample_ring_t *ring)
+{
+    reader->ring = ring;
+    reader->tail = atomic_load_explicit(&ring->head, memory_order_acquire);
+    reader->lost = 0;
+}
+
+bool sample_reader_next(sample_reader_t *reader, sensor_sample_t *sample)
+{
+    sample_ring_t *ring = reader->ring;
+
+    for (;;) {
+        unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (reader->tail == head) {
+            return false;
+        }
+        if (head - reader->tail > CONFIG_WEATHER_SAMPLE_RING_DEPTH) {
+            reader->lost += head - reader->tail - CONFIG_WEATHER_SAMPLE_RING_DEPTH;
+            reader->tail = head - CONFIG_WEATHER_SAMPLE_RING_DEPTH;
+        }
+
+        sample_slot_t *slot = &ring->slots[reader->tail % CONFIG_WEATHER_SAMPLE_RING_DEPTH];
+        unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        memcpy(sample, &slot->sample, sizeof(*sample));
+        atomic_thread_fence(memory_order_acquire);
+        bool valid = seq == reader->tail + 1 &&
+                     atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq;
+        reader->tail++;
+        if (valid) {
+            return true;
+        }
+        reader->lost++;     // overwritten while we were copying it
+    }
+}
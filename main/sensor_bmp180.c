@@ -0,0 +1,179 @@
+/* BMP180 barometer driver for the sensor bus
+
+   The BMP180 needs a conversion wait after each command (4.5 ms for
+   temperature, 25.5 ms for pressure in ultra high resolution mode). Rather
+   than sleeping through it with the device locked, the driver starts the
+   conversion, hands the bus back to the executor and reads the result when
+   the conversion is done.
+*/
+#include <string.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "bmp180.h"
+
+#include "sdkconfig.h"
+#include "weather.h"
+
+static const char *TAG = "bmp180";
+
+#define BMP180_REG_CTRL         0xF4
+#define BMP180_REG_OUT          0xF6
+#define BMP180_CMD_TEMPERATURE  0x2E
+#define BMP180_CMD_PRESSURE     0x34
+
+#define BMP180_OSS              BMP180_MODE_ULTRA_HIGH_RESOLUTION
+
+/* Datasheet maximum conversion times plus a little margin */
+#define BMP180_TEMPERATURE_US   5000
+static const int64_t bmp180_pressure_us[] = { 5000, 8000, 14000, 26000 };
+
+typedef enum {
+    BMP180_STATE_IDLE,
+    BMP180_STATE_TEMPERATURE,   // temperature conversion running
+    BMP180_STATE_PRESSURE,      // pressure conversion running
+} bmp180_state_t;
+
+static struct {
+    bmp180_dev_t dev;
+    bmp180_state_t state;
+    int64_t deadline;           // conversion end, or next sample when idle
+    int64_t next_sample;
+    int32_t ut;
+} s_bmp;
+
+static esp_err_t bmp180_command(bmp180_dev_t *dev, uint8_t cmd)
+{
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_write_reg(&dev->i2c_dev, BMP180_REG_CTRL, &cmd, 1));
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+    return ESP_OK;
+}
+
+static esp_err_t bmp180_result(bmp180_dev_t *dev, uint8_t *buf, size_t len)
+{
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_read_reg(&dev->i2c_dev, BMP180_REG_OUT, buf, len));
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+    return ESP_OK;
+}
+
+/* Compensation from the BMP180 datasheet, section 3.5 */
+static void bmp180_compensate(const bmp180_dev_t *dev, int32_t ut, uint32_t up, int oss,
+                              float *temperature, uint32_t *pressure)
+{
+    int32_t x1, x2, x3, b3, b5, b6, p;
+    uint32_t b4, b7;
+
+    x1 = ((ut - (int32_t)dev->AC6) * (int32_t)dev->AC5) >> 15;
+    x2 = ((int32_t)dev->MC << 11) / (x1 + (int32_t)dev->MD);
+    b5 = x1 + x2;
+    *temperature = ((b5 + 8) >> 4) / 10.0f;
+
+    b6 = b5 - 4000;
+    x1 = ((int32_t)dev->B2 * ((b6 * b6) >> 12)) >> 11;
+    x2 = ((int32_t)dev->AC2 * b6) >> 11;
+    x3 = x1 + x2;
+    b3 = ((((int32_t)dev->AC1 * 4 + x3) << oss) + 2) >> 2;
+    x1 = ((int32_t)dev->AC3 * b6) >> 13;
+    x2 = ((int32_t)dev->B1 * ((b6 * b6) >> 12)) >> 16;
+    x3 = ((x1 + x2) + 2) >> 2;
+    b4 = ((uint32_t)dev->AC4 * (uint32_t)(x3 + 32768)) >> 15;
+    b7 = (up - b3) * (uint32_t)(50000UL >> oss);
+    p = (b7 < 0x80000000) ? (int32_t)((b7 * 2) / b4) : (int32_t)((b7 / b4) * 2);
+
+    x1 = (p >> 8) * (p >> 8);
+    x1 = (x1 * 3038) >> 16;
+    x2 = (-7357 * p) >> 16;
+    *pressure = p + ((x1 + x2 + 3791) >> 4);
+}
+
+static void bmp180_publish(uint32_t up, int64_t now)
+{
+    float temperature;
+    uint32_t pressure;
+    bmp180_compensate(&s_bmp.dev, s_bmp.ut, up, BMP180_OSS, &temperature, &pressure);
+    float altitude = altitude_mm(pressure) / 1000.0f;
+
+    sensor_message_t msg = {
+        .type = MSG_BMP180_DATA,
+        .data.bmp180 = {
+            .temperature = temperature,
+            .pressure = pressure,
+            .altitude = altitude
+        }
+    };
+    sensor_bus_emit(&msg, now);
+}
+
+/* Advance the BMP180 state machine, returns when it next needs the bus */
+static int64_t bmp180_service(int64_t now, bool woken)
+{
+    esp_err_t err = ESP_OK;
+    uint8_t raw[3];
+
+    if (now < s_bmp.deadline) {
+        return s_bmp.deadline;
+    }
+
+    switch (s_bmp.state) {
+    case BMP180_STATE_IDLE:
+        err = bmp180_command(&s_bmp.dev, BMP180_CMD_TEMPERATURE);
+        s_bmp.state = BMP180_STATE_TEMPERATURE;
+        s_bmp.deadline = now + BMP180_TEMPERATURE_US;
+        s_bmp.next_sample += CONFIG_WEATHER_BMP180_PERIOD_MS * 1000LL;
+        if (s_bmp.next_sample < now) {
+            s_bmp.next_sample = now + CONFIG_WEATHER_BMP180_PERIOD_MS * 1000LL;     // fell behind, don't burst
+        }
+        break;
+    case BMP180_STATE_TEMPERATURE:
+        err = bmp180_result(&s_bmp.dev, raw, 2);
+        if (err == ESP_OK) {
+            s_bmp.ut = (raw[0] << 8) | raw[1];
+            err = bmp180_command(&s_bmp.dev, BMP180_CMD_PRESSURE | (BMP180_OSS << 6));
+        }
+        s_bmp.state = BMP180_STATE_PRESSURE;
+        s_bmp.deadline = now + bmp180_pressure_us[BMP180_OSS];
+        break;
+    case BMP180_STATE_PRESSURE:
+        err = bmp180_result(&s_bmp.dev, raw, 3);
+        if (err == ESP_OK) {
+            bmp180_publish((((uint32_t)raw[0] << 16) | ((uint32_t)raw[1] << 8) | raw[2]) >> (8 - BMP180_OSS), now);
+        }
+        s_bmp.state = BMP180_STATE_IDLE;
+        s_bmp.deadline = s_bmp.next_sample;
+        break;
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Reading of pressure from BMP180 failed, err = %d", err);
+        s_bmp.state = BMP180_STATE_IDLE;
+        s_bmp.deadline = s_bmp.next_sample;
+    }
+    return s_bmp.deadline;
+}
+
+static esp_err_t bmp180_start(void)
+{
+    ESP_RETURN_ON_ERROR(bmp180_init_desc(&s_bmp.dev, 0, I2C_PIN_SDA, I2C_PIN_SCL), TAG, "init_desc");
+    ESP_RETURN_ON_ERROR(bmp180_init(&s_bmp.dev), TAG, "init");
+    s_bmp.state = BMP180_STATE_IDLE;
+    s_bmp.deadline = s_bmp.next_sample = esp_timer_get_time();
+    return ESP_OK;
+}
+
+static const sensor_field_t bmp180_fields[] = {
+    SENSOR_FIELD(bmp180, temperature, "degC", SENSOR_FIELD_FLOAT, temperature),
+    SENSOR_FIELD(bmp180, pressure, "Pa", SENSOR_FIELD_UINT32, pressure),
+    SENSOR_FIELD(bmp180, altitude, "m", SENSOR_FIELD_FLOAT, altitude),
+};
+
+const sensor_driver_t bmp180_driver = {
+    .name = "BMP180",
+    .period_ms = CONFIG_WEATHER_BMP180_PERIOD_MS,
+    .init = bmp180_start,
+    .service = bmp180_service,
+    .fields = bmp180_fields,
+    .field_count = sizeof(bmp180_fields) / sizeof(bmp180_fields[0]),
+};
@@ -0,0 +1,96 @@
+/* I2C bus scheduler
+
+   One task owns I2C port 0 and runs every driver in sensor_drivers[], so a
+   new sensor costs a table entry and its own state rather than another
+   task and stack. Each driver is a small state machine: service() does
+   whatever bus work is due and returns the time it next needs the bus, and
+   the task sleeps until the earliest of those. A driver that has to wait
+   on the device (a conversion, say) returns early and lets the others use
+   the bus in the gap.
+
+   Interrupt driven drivers call sensor_bus_wake_from_isr() with their
+   index; the task wakes and services that driver with woken set.
+*/
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sdkconfig.h"
+#include "weather.h"
+
+static const char *TAG = "sensor_bus";
+
+const sensor_driver_t *const sensor_drivers[MSG_SENSOR_COUNT] = {
+#define SENSOR_DRIVER(ID, name) [MSG_##ID##_DATA] = &name##_driver,
+    SENSOR_LIST(SENSOR_DRIVER)
+#undef SENSOR_DRIVER
+};
+
+static TaskHandle_t s_bus_task;
+
+/* Hand a new reading to the sample ring and the publisher, neither of which
+   waits */
+void sensor_bus_emit(const sensor_message_t *msg, int64_t timestamp)
+{
+    sensor_sample_t sample = {
+        .timestamp = timestamp,
+        .msg = *msg,
+    };
+    sample_ring_push(&sensor_rings[msg->type], &sample);
+    publisher_post(&sample);
+}
+
+void IRAM_ATTR sensor_bus_wake_from_isr(sensor_msg_type_t sensor)
+{
+    BaseType_t woken = pdFALSE;
+    xTaskNotifyFromISR(s_bus_task, 1u << sensor, eSetBits, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+/* Sleep until the deadline, or until a driver's interrupt. Returns the
+   bit mask of drivers woken, indexed by sensor_msg_type_t. */
+static uint32_t sensor_bus_wait(int64_t deadline)
+{
+    const int64_t tick_us = 1000000 / configTICK_RATE_HZ;
+    int64_t wait = deadline - esp_timer_get_time();
+    TickType_t ticks = wait > 0 ? (wait + tick_us - 1) / tick_us : 0;
+    uint32_t woken = 0;
+
+    xTaskNotifyWait(0, UINT32_MAX, &woken, ticks);
+    return woken;
+}
+
+void sensor_bus_task(void *pvParameter)
+{
+    bool running[MSG_SENSOR_COUNT];
+
+    s_bus_task = xTaskGetCurrentTaskHandle();
+
+    for (int i = 0; i < MSG_SENSOR_COUNT; i++) {
+        esp_err_t err = sensor_drivers[i]->init();
+        running[i] = err == ESP_OK;
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "%s init failed, err = %d, leaving it out", sensor_drivers[i]->name, err);
+        }
+    }
+
+    uint32_t woken = 0;
+    while (1) {
+        int64_t now = esp_timer_get_time();
+        int64_t next = INT64_MAX;
+        for (int i = 0; i < MSG_SENSOR_COUNT; i++) {
+            if (!running[i]) {
+                continue;
+            }
+            int64_t deadline = sensor_drivers[i]->service(now, woken & (1u << i));
+            if (deadline < next) {
+                next = deadline;
+            }
+        }
+        woken = sensor_bus_wait(next);
+    }
+}
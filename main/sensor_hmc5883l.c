@@ -0,0 +1,162 @@
+/* HMC5883L magnetometer driver for the sensor bus
+
+   With CONFIG_WEATHER_HMC5883L_DRDY the DRDY interrupt wakes the executor
+   for this driver, so every conversion the HMC5883L makes is read and
+   averaged down to the published rate instead of polling one sample in
+   thirty.
+*/
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "hmc5883l.h"
+
+#include "sdkconfig.h"
+#include "weather.h"
+
+static const char *TAG = "hmc5883l";
+
+/* HMC5883L native output period at HMC5883L_DATA_RATE_30_00 */
+#define HMC5883L_SAMPLE_US      33334
+/* Without a DRDY pulse for this long the sample is polled instead */
+#define HMC5883L_DRDY_TIMEOUT_US (3 * HMC5883L_SAMPLE_US)
+
+static struct {
+    hmc5883l_dev_t dev;
+    int64_t deadline;           // next poll, or DRDY timeout
+#if CONFIG_WEATHER_HMC5883L_DRDY
+    float sum_x, sum_y, sum_z;  // decimation accumulator
+    int count;
+    bool drdy_lost;
+#endif
+} s_hmc;
+
+static void hmc5883l_publish(float x, float y, float z, int64_t now)
+{
+    mag_cal_apply(&x, &y, &z);
+    int angle = atan2(y, x) * (180 / 3.14159265) + 180;
+    sensor_message_t msg = {
+        .type = MSG_HMC5883L_DATA,
+        .data.hmc5883l = {
+            .heading = angle,
+            .x = x,
+            .y = y,
+            .z = z
+        }
+    };
+    sensor_bus_emit(&msg, now);
+}
+
+#if CONFIG_WEATHER_HMC5883L_DRDY
+static void IRAM_ATTR hmc5883l_drdy_isr(void *arg)
+{
+    sensor_bus_wake_from_isr(MSG_HMC5883L_DATA);
+}
+
+static esp_err_t hmc5883l_drdy_init(void)
+{
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << CONFIG_WEATHER_HMC5883L_DRDY_GPIO,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,     // DRDY pulses low when new data is latched
+    };
+    ESP_RETURN_ON_ERROR(gpio_config(&io_conf), TAG, "gpio_config");
+    ESP_RETURN_ON_ERROR(gpio_install_isr_service(0), TAG, "gpio_install_isr_service");
+    return gpio_isr_handler_add(CONFIG_WEATHER_HMC5883L_DRDY_GPIO, hmc5883l_drdy_isr, NULL);
+}
+
+/* Read every conversion on DRDY and publish the mean of each block of
+ * CONFIG_WEATHER_HMC5883L_DECIMATION samples (a boxcar low-pass filter) */
+static int64_t hmc5883l_service(int64_t now, bool drdy)
+{
+    if (!drdy && now < s_hmc.deadline) {
+        return s_hmc.deadline;
+    }
+    if (!drdy && !s_hmc.drdy_lost) {
+        ESP_LOGW(TAG, "No DRDY from HMC5883L on GPIO%d, polling", CONFIG_WEATHER_HMC5883L_DRDY_GPIO);
+    }
+    s_hmc.drdy_lost = !drdy;
+    s_hmc.deadline = now + HMC5883L_DRDY_TIMEOUT_US;
+
+    hmc5883l_data_t data;
+    esp_err_t err = hmc5883l_get_data(&s_hmc.dev, &data);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Reading of data from HMC5883L failed, err = %d", err);
+        return s_hmc.deadline;
+    }
+
+    mag_cal_update(data.x, data.y, data.z);
+    s_hmc.sum_x += data.x;
+    s_hmc.sum_y += data.y;
+    s_hmc.sum_z += data.z;
+    if (++s_hmc.count == CONFIG_WEATHER_HMC5883L_DECIMATION) {
+        hmc5883l_publish(s_hmc.sum_x / s_hmc.count, s_hmc.sum_y / s_hmc.count, s_hmc.sum_z / s_hmc.count, now);
+        s_hmc.sum_x = s_hmc.sum_y = s_hmc.sum_z = 0;
+        s_hmc.count = 0;
+    }
+    return s_hmc.deadline;
+}
+#else
+static int64_t hmc5883l_service(int64_t now, bool drdy)
+{
+    if (now < s_hmc.deadline) {
+        return s_hmc.deadline;
+    }
+
+    hmc5883l_data_t data;
+    esp_err_t err = hmc5883l_get_data(&s_hmc.dev, &data);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Reading of data from HMC5883L failed, err = %d", err);
+    } else {
+        mag_cal_update(data.x, data.y, data.z);
+        hmc5883l_publish(data.x, data.y, data.z, now);
+    }
+
+    s_hmc.deadline += CONFIG_WEATHER_HMC5883L_PERIOD_MS * 1000LL;
+    if (s_hmc.deadline < now) {
+        s_hmc.deadline = now + CONFIG_WEATHER_HMC5883L_PERIOD_MS * 1000LL;
+    }
+    return s_hmc.deadline;
+}
+#endif // CONFIG_WEATHER_HMC5883L_DRDY
+
+static esp_err_t hmc5883l_start(void)
+{
+    ESP_RETURN_ON_ERROR(hmc5883l_init_desc(&s_hmc.dev, 0, I2C_PIN_SDA, I2C_PIN_SCL), TAG, "init_desc");
+    ESP_RETURN_ON_ERROR(hmc5883l_init(&s_hmc.dev), TAG, "init");
+    ESP_RETURN_ON_ERROR(hmc5883l_set_opmode(&s_hmc.dev, HMC5883L_MODE_CONTINUOUS), TAG, "opmode");
+    ESP_RETURN_ON_ERROR(hmc5883l_set_samples_averaged(&s_hmc.dev, HMC5883L_SAMPLES_8), TAG, "samples");
+    ESP_RETURN_ON_ERROR(hmc5883l_set_data_rate(&s_hmc.dev, HMC5883L_DATA_RATE_30_00), TAG, "data rate");
+    ESP_RETURN_ON_ERROR(hmc5883l_set_gain(&s_hmc.dev, HMC5883L_GAIN_1370), TAG, "gain");
+#if CONFIG_WEATHER_HMC5883L_DRDY
+    ESP_RETURN_ON_ERROR(hmc5883l_drdy_init(), TAG, "DRDY");
+#endif
+    s_hmc.deadline = esp_timer_get_time();
+    return ESP_OK;
+}
+
+static const sensor_field_t hmc5883l_fields[] = {
+    SENSOR_FIELD(hmc5883l, heading, "deg", SENSOR_FIELD_INT, angle),
+    SENSOR_FIELD(hmc5883l, x, "mG", SENSOR_FIELD_FLOAT, x),
+    SENSOR_FIELD(hmc5883l, y, "mG", SENSOR_FIELD_FLOAT, y),
+    SENSOR_FIELD(hmc5883l, z, "mG", SENSOR_FIELD_FLOAT, z),
+};
+
+const sensor_driver_t hmc5883l_driver = {
+    .name = "HMC5883L",
+#if CONFIG_WEATHER_HMC5883L_DRDY
+    .period_ms = CONFIG_WEATHER_HMC5883L_DECIMATION * HMC5883L_SAMPLE_US / 1000,
+#else
+    .period_ms = CONFIG_WEATHER_HMC5883L_PERIOD_MS,
+#endif
+    .init = hmc5883l_start,
+    .service = hmc5883l_service,
+    .fields = hmc5883l_fields,
+    .field_count = sizeof(hmc5883l_fields) / sizeof(hmc5883l_fields[0]),
+};
@@ -0,0 +1,198 @@
+/* Readings over time at three resolutions
+
+   Every sample the publisher task takes goes into three rings of fixed
+   size, set in Kconfig:
+
+   - raw: one slot per second with the latest reading of each channel in
+     it, NaN for a channel not read in that second
+   - minutes and hours: min, max, mean and count of each channel's readings
+
+   A sample only updates the slot of its own second, minute and hour, so
+   adding one costs the same however long the history, and a query reads
+   the rollups as they stand without aggregating anything. The slot still
+   being filled is readable too, with the readings so far. Slots are
+   numbered by second, minute or hour since boot (esp_timer), and a period
+   without readings has no slot.
+
+   The publisher task is the only writer; the httpd task reads. As in
+   history.c each slot carries the number it holds plus one, cleared while
+   it is written, so a reader detects a slot that changed under it. The
+   channels are the 32 bit fields of weather_data_t, in WEATHER_FIELD_BIT()
+   order, named after the sensor driver fields that fill them.
+*/
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "weather.h"
+
+#define US_PER_S                1000000LL
+
+typedef struct {
+    atomic_uint seq;            // second since boot + 1, 0 while being written
+    float value[WEATHER_CHANNELS];
+} ts_raw_slot_t;
+
+typedef struct {
+    atomic_uint seq;            // minute or hour since boot + 1, 0 while being written
+    ts_stat_t stat[WEATHER_CHANNELS];
+} ts_rollup_slot_t;
+
+static ts_raw_slot_t s_raw[CONFIG_WEATHER_TS_RAW_SECONDS];
+static ts_rollup_slot_t s_minutes[CONFIG_WEATHER_TS_MINUTES];
+static ts_rollup_slot_t s_hours[CONFIG_WEATHER_TS_HOURS];
+
+static const struct {
+    ts_rollup_slot_t *slots;
+    unsigned depth;
+    int64_t interval_us;
+} s_rollups[TS_ROLLUPS] = {
+    [TS_MINUTE] = { s_minutes, CONFIG_WEATHER_TS_MINUTES, 60 * US_PER_S },
+    [TS_HOUR]   = { s_hours, CONFIG_WEATHER_TS_HOURS, 3600 * US_PER_S },
+};
+
+// The slots being filled, kept here by the writer
+static struct {
+    uint32_t seq;               // 0 before the first sample
+    float value[WEATHER_CHANNELS];
+} s_raw_open;
+
+static struct {
+    uint32_t seq;
+    ts_stat_t stat[WEATHER_CHANNELS];
+} s_rollup_open[TS_ROLLUPS];
+
+static atomic_uint s_raw_newest;
+static atomic_uint s_rollup_newest[TS_ROLLUPS];
+
+static void slot_write(atomic_uint *seq, void *dest, const void *src, size_t size, uint32_t value)
+{
+    atomic_store_explicit(seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(dest, src, size);
+    atomic_store_explicit(seq, value, memory_order_release);
+}
+
+static bool slot_read(atomic_uint *seq, void *dest, const void *src, size_t size, uint32_t value)
+{
+    if (atomic_load_explicit(seq, memory_order_acquire) != value) {
+        return false;
+    }
+    memcpy(dest, src, size);
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(seq, memory_order_relaxed) == value;
+}
+
+void timeseries_add(const sensor_sample_t *sample)
+{
+    const sensor_driver_t *driver = sensor_drivers[sample->msg.type];
+    uint32_t second = sample->timestamp / US_PER_S + 1;
+
+    // A sample a little older than the open slot, from the other sensor,
+    // counts towards the open slot
+    if (second > s_raw_open.seq) {
+        s_raw_open.seq = second;
+        for (int i = 0; i < WEATHER_CHANNELS; i++) {
+            s_raw_open.value[i] = NAN;
+        }
+    }
+    for (int r = 0; r < TS_ROLLUPS; r++) {
+        uint32_t seq = sample->timestamp / s_rollups[r].interval_us + 1;
+        if (seq > s_rollup_open[r].seq) {
+            s_rollup_open[r].seq = seq;
+            memset(s_rollup_open[r].stat, 0, sizeof(s_rollup_open[r].stat));
+        }
+    }
+
+    for (int i = 0; i < driver->field_count; i++) {
+        const sensor_field_t *field = &driver->fields[i];
+        const uint8_t *src = (const uint8_t *)&sample->msg + field->offset;
+        int channel = field->snapshot_offset / 4;
+        float value;
+        if (field->type == SENSOR_FIELD_FLOAT) {
+            memcpy(&value, src, sizeof(value));
+        } else if (field->type == SENSOR_FIELD_UINT32) {
+            uint32_t u;
+            memcpy(&u, src, sizeof(u));
+            value = u;
+        } else {
+            int n;
+            memcpy(&n, src, sizeof(n));
+            value = n;
+        }
+        if (channel >= WEATHER_CHANNELS || !isfinite(value)) {
+            continue;
+        }
+
+        s_raw_open.value[channel] = value;
+        for (int r = 0; r < TS_ROLLUPS; r++) {
+            ts_stat_t *stat = &s_rollup_open[r].stat[channel];
+            if (stat->count == 0) {
+                stat->min = stat->max = stat->mean = value;
+            } else {
+                stat->min = fminf(stat->min, value);
+                stat->max = fmaxf(stat->max, value);
+            }
+            // A running mean, as a float sum of an hour of pressures would
+            // lose whole Pa
+            stat->count++;
+            stat->mean += (value - stat->mean) / stat->count;
+        }
+    }
+
+    ts_raw_slot_t *raw = &s_raw[s_raw_open.seq % CONFIG_WEATHER_TS_RAW_SECONDS];
+    slot_write(&raw->seq, raw->value, s_raw_open.value, sizeof(raw->value), s_raw_open.seq);
+    atomic_store_explicit(&s_raw_newest, s_raw_open.seq, memory_order_release);
+
+    for (int r = 0; r < TS_ROLLUPS; r++) {
+        ts_rollup_slot_t *slot = &s_rollups[r].slots[s_rollup_open[r].seq % s_rollups[r].depth];
+        slot_write(&slot->seq, slot->stat, s_rollup_open[r].stat, sizeof(slot->stat), s_rollup_open[r].seq);
+        atomic_store_explicit(&s_rollup_newest[r], s_rollup_open[r].seq, memory_order_release);
+    }
+}
+
+uint32_t timeseries_raw_newest(void)
+{
+    return atomic_load_explicit(&s_raw_newest, memory_order_acquire);
+}
+
+bool timeseries_raw_get(uint32_t seq, float value[WEATHER_CHANNELS])
+{
+    ts_raw_slot_t *slot = &s_raw[seq % CONFIG_WEATHER_TS_RAW_SECONDS];
+    return seq != 0 && slot_read(&slot->seq, value, slot->value, sizeof(slot->value), seq);
+}
+
+uint32_t timeseries_newest(ts_rollup_t rollup)
+{
+    return atomic_load_explicit(&s_rollup_newest[rollup], memory_order_acquire);
+}
+
+bool timeseries_get(ts_rollup_t rollup, uint32_t seq, ts_stat_t stat[WEATHER_CHANNELS])
+{
+    ts_rollup_slot_t *slot = &s_rollups[rollup].slots[seq % s_rollups[rollup].depth];
+    return seq != 0 && slot_read(&slot->seq, stat, slot->stat, sizeof(slot->stat), seq);
+}
+
+unsigned timeseries_depth(ts_rollup_t rollup)
+{
+    return s_rollups[rollup].depth;
+}
+
+int64_t timeseries_interval_us(ts_rollup_t rollup)
+{
+    return s_rollups[rollup].interval_us;
+}
+
+/* The name of the driver field that fills a channel, or NULL */
+const char *timeseries_channel_name(int channel)
+{
+    for (int s = 0; s < MSG_SENSOR_COUNT; s++) {
+        for (int i = 0; i < sensor_drivers[s]->field_count; i++) {
+            if (sensor_drivers[s]->fields[i].snapshot_offset / 4 == channel) {
+                return sensor_drivers[s]->fields[i].name;
+            }
+        }
+    }
+    return NULL;
+}
@@ -1,7 +1,13 @@
 #ifndef WEATHER_H
 #define WEATHER_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_http_server.h"
 
 typedef struct {
     float temperature;
@@ -9,44 +15,242 @@ typedef struct {
     float altitude;
     int angle;
     float x, y, z;
+    int64_t timestamp;      // esp_timer_get_time() of the latest reading
 } weather_data_t;
 
-// Add new message types and structures
+// Change mask bit for a 32 bit field of weather_data_t
+#define WEATHER_FIELD_BIT(field) (1u << (offsetof(weather_data_t, field) / 4))
+// The 32 bit fields of weather_data_t, temperature to z, as channels
+#define WEATHER_CHANNELS (int)(offsetof(weather_data_t, z) / 4 + 1)
+
+// Payload of each sensor's messages
+typedef struct {
+    float temperature;
+    uint32_t pressure;
+    float altitude;
+} bmp180_payload_t;
+
+typedef struct {
+    int heading;
+    float x;
+    float y;
+    float z;
+} hmc5883l_payload_t;
+
+/* Every sensor the bus scheduler runs. Adding one takes a <name>_payload_t
+   above, an entry here and a driver file defining <name>_driver. */
+#define SENSOR_LIST(X) \
+    X(BMP180, bmp180) \
+    X(HMC5883L, hmc5883l)
+
 typedef enum {
-    MSG_BMP180_DATA,
-    MSG_HMC5883L_DATA
+#define SENSOR_MSG_TYPE(ID, name) MSG_##ID##_DATA,
+    SENSOR_LIST(SENSOR_MSG_TYPE)
+#undef SENSOR_MSG_TYPE
+    MSG_SENSOR_COUNT
 } sensor_msg_type_t;
 
 typedef struct {
     sensor_msg_type_t type;
     union {
-        struct {
-            float temperature;
-            uint32_t pressure;
-            float altitude;
-        } bmp180;
-        struct {
-            int heading;
-            float x;
-            float y;
-            float z;
-        } hmc5883l;
+#define SENSOR_PAYLOAD(ID, name) name##_payload_t name;
+        SENSOR_LIST(SENSOR_PAYLOAD)
+#undef SENSOR_PAYLOAD
     } data;
 } sensor_message_t;
 
+typedef enum {
+    SENSOR_FIELD_FLOAT,
+    SENSOR_FIELD_UINT32,
+    SENSOR_FIELD_INT,
+} sensor_field_type_t;
+
+// One 32 bit field of a sensor's payload and where it goes in weather_data_t
+typedef struct {
+    const char *name;
+    const char *unit;
+    sensor_field_type_t type;
+    uint16_t offset;            // in sensor_message_t
+    uint16_t snapshot_offset;   // in weather_data_t
+} sensor_field_t;
+
+#define SENSOR_FIELD(sensor, field, unit, type, snapshot_field) \
+    { #field, unit, type, offsetof(sensor_message_t, data.sensor.field), offsetof(weather_data_t, snapshot_field) }
+
+// A sensor driver, run by the bus scheduler (see sensor_bus.c)
+typedef struct {
+    const char *name;
+    uint32_t period_ms;                             // nominal time between messages
+    esp_err_t (*init)(void);
+    int64_t (*service)(int64_t now, bool woken);    // returns when it next needs the bus
+    const sensor_field_t *fields;
+    uint8_t field_count;
+} sensor_driver_t;
+
+typedef struct {
+    int64_t timestamp;      // esp_timer_get_time() when the sample was taken
+    sensor_message_t msg;
+} sensor_sample_t;
+
+typedef struct {
+    atomic_uint seq;        // index of the sample in the slot, + 1 once complete
+    sensor_sample_t sample;
+} sample_slot_t;
+
+// Single producer ring of samples, see sample_ring.c
+typedef struct {
+    atomic_uint head;       // number of samples ever pushed
+    sample_slot_t slots[CONFIG_WEATHER_SAMPLE_RING_DEPTH];
+} sample_ring_t;
+
+// One consumer's read position in a sample ring
+typedef struct {
+    sample_ring_t *ring;
+    unsigned tail;
+    unsigned lost;          // samples overwritten before this reader got to them
+} sample_reader_t;
+
+typedef struct {
+    unsigned depth;
+    unsigned max_queued;        // high-water mark of the queue
+    unsigned dropped;           // readings that found the queue full
+} publisher_stats_t;
+
+// One channel over a minute or an hour, see timeseries.c
+typedef struct {
+    float min;
+    float max;
+    float mean;
+    uint32_t count;             // readings; 0 if there were none
+} ts_stat_t;
+
+typedef enum {
+    TS_MINUTE,
+    TS_HOUR,
+    TS_ROLLUPS
+} ts_rollup_t;
+
+// One encoding of a web asset; data is NULL if there is none
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    const char *etag;
+} web_variant_t;
+
+// A web asset, built in (html_to_c.py) or from the assets partition
+typedef struct {
+    const char *path;
+    const char *type;
+    web_variant_t raw;
+    web_variant_t gz;
+    web_variant_t br;
+} web_asset_t;
+
+// Streaming JSON into a fixed buffer, see json_writer.c
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;                 // may pass size, then the output is incomplete
+    bool first;                 // no comma before the next member
+} json_writer_t;
+
 #define LED_GPIO 2
 #define I2C_PIN_SDA 21
 #define I2C_PIN_SCL 22
 #define REFERENCE_PRESSURE 101325l
 
 // Globals used for inter-task communication here - don't judge
-extern volatile weather_data_t weather_data;
 extern httpd_handle_t server;
-extern int client_fd;
 
 void wifi_init_sta(void);
 httpd_handle_t start_webserver(void);
-esp_err_t send_sensor_data(sensor_message_t *msg);
+esp_err_t send_sensor_data(uint32_t changed);
+void sensor_bus_task(void *pvParameter);
+
+// Sensor drivers, indexed by sensor_msg_type_t
+#define SENSOR_DRIVER_DECL(ID, name) extern const sensor_driver_t name##_driver;
+SENSOR_LIST(SENSOR_DRIVER_DECL)
+#undef SENSOR_DRIVER_DECL
+extern const sensor_driver_t *const sensor_drivers[MSG_SENSOR_COUNT];
+void sensor_bus_emit(const sensor_message_t *msg, int64_t timestamp);
+void sensor_bus_wake_from_isr(sensor_msg_type_t sensor);
+
+// Readings from the sensor bus to the web side (see publisher.c)
+void publisher_init(void);
+esp_err_t publisher_post(const sensor_sample_t *sample);
+void publisher_get_stats(publisher_stats_t *stats);
+void publisher_task(void *pvParameter);
+
+// Latest readings, safe to read from any task (see weather_snapshot.c)
+uint32_t weather_snapshot_publish(const sensor_message_t *msg, int64_t timestamp);
+uint32_t weather_snapshot_read(weather_data_t *data);
+#if CONFIG_WEATHER_SNAPSHOT_STRESS
+void weather_snapshot_stress(void);
+#endif
+
+// Snapshots sent to the clients, by sequence number (see history.c)
+uint32_t history_append(const weather_data_t *data);
+uint32_t history_newest(void);
+bool history_get(uint32_t seq, weather_data_t *data);
+
+// Readings over time: per second, minute and hour (see timeseries.c)
+void timeseries_add(const sensor_sample_t *sample);
+uint32_t timeseries_raw_newest(void);
+bool timeseries_raw_get(uint32_t seq, float value[WEATHER_CHANNELS]);
+uint32_t timeseries_newest(ts_rollup_t rollup);
+bool timeseries_get(ts_rollup_t rollup, uint32_t seq, ts_stat_t stat[WEATHER_CHANNELS]);
+unsigned timeseries_depth(ts_rollup_t rollup);
+int64_t timeseries_interval_us(ts_rollup_t rollup);
+const char *timeseries_channel_name(int channel);
+
+// Web asset bundle in the assets partition (see asset_store.c)
+uint32_t web_asset_hash(const char *path, size_t len, uint32_t seed);
+esp_err_t asset_store_init(void);
+const web_asset_t *asset_store_find(const char *path, size_t len);
+esp_err_t asset_store_begin(size_t size);
+esp_err_t asset_store_write(const void *data, size_t len);
+esp_err_t asset_store_finish(void);
+
+// Barometric altitude in mm for a pressure in Pa (see altitude.c)
+void altitude_init(void);
+void altitude_set_reference(uint32_t p0);
+int32_t altitude_mm(uint32_t pressure);
+#if CONFIG_WEATHER_ALTITUDE_BENCHMARK
+void altitude_benchmark(void);
+#endif
+
+// Magnetometer hard/soft-iron calibration (see mag_cal.c)
+void mag_cal_init(void);
+void mag_cal_update(float x, float y, float z);
+void mag_cal_apply(float *x, float *y, float *z);
+void mag_cal_save(void);
+
+#if CONFIG_WEATHER_ALLOC_CHECK
+// Steady state heap allocation check, see alloc_check.c
+void alloc_check_report(void);
+void alloc_check_exempt(bool exempt);
+#endif
+
+#if CONFIG_WEATHER_JSON_BENCHMARK
+void web_json_benchmark(void);
+#endif
+void json_writer_init(json_writer_t *w, char *buf, size_t size);
+void json_object_begin(json_writer_t *w, const char *key);
+void json_object_end(json_writer_t *w);
+void json_array_begin(json_writer_t *w, const char *key);
+void json_array_end(json_writer_t *w);
+void json_add_string(json_writer_t *w, const char *key, const char *value);
+void json_add_int(json_writer_t *w, const char *key, int32_t value);
+void json_add_uint(json_writer_t *w, const char *key, uint32_t value);
+void json_add_int64(json_writer_t *w, const char *key, int64_t value);
+void json_add_fixed(json_writer_t *w, const char *key, float value, int decimals);
+bool json_writer_finish(json_writer_t *w);
+
+// Timestamped sample history per sensor, indexed by sensor_msg_type_t
+extern sample_ring_t sensor_rings[MSG_SENSOR_COUNT];
+void sample_ring_push(sample_ring_t *ring, const sensor_sample_t *sample);
+void sample_reader_init(sample_reader_t *reader, sample_ring_t *ring);
+bool sample_reader_next(sample_reader_t *reader, sensor_sample_t *sample);
 
 
 #endif /* WEATHER_H */
\ No newline at end of file
@@ -0,0 +1,152 @@
+/* Consistent snapshots of the latest weather readings
+
+   The publisher task writes the readings here and the web server reads a
+   whole weather_data_t back, without either side taking a mutex.
+
+   This is a sequence lock: the sequence number is odd while a writer is
+   updating the data and is bumped to the next even value when it is done.
+   A reader copies the data and retries if the sequence was odd or changed
+   under it. Writers hold a spinlock for the few stores of an update, which
+   also keeps a reader on the same core from preempting a half written copy.
+*/
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "sdkconfig.h"
+#include "weather.h"
+
+static weather_data_t s_data;
+static atomic_uint s_seq;
+static portMUX_TYPE s_write_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Returns the WEATHER_FIELD_BIT()s of the fields whose value changed */
+uint32_t weather_snapshot_publish(const sensor_message_t *msg, int64_t timestamp)
+{
+    uint32_t changed = 0;
+
+    taskENTER_CRITICAL(&s_write_lock);
+    unsigned seq = atomic_load_explicit(&s_seq, memory_order_relaxed);
+    atomic_store_explicit(&s_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    const sensor_driver_t *driver = sensor_drivers[msg->type];
+    for (int i = 0; i < driver->field_count; i++) {
+        const sensor_field_t *field = &driver->fields[i];
+        uint8_t *dest = (uint8_t *)&s_data + field->snapshot_offset;
+        const uint8_t *src = (const uint8_t *)msg + field->offset;
+        if (memcmp(dest, src, 4) != 0) {
+            memcpy(dest, src, 4);
+            changed |= 1u << (field->snapshot_offset / 4);
+        }
+    }
+    s_data.timestamp = timestamp;
+
+    atomic_store_explicit(&s_seq, seq + 2, memory_order_release);
+    taskEXIT_CRITICAL(&s_write_lock);
+    return changed;
+}
+
+uint32_t weather_snapshot_read(weather_data_t *data)
+{
+    for (;;) {
+        unsigned begin = atomic_load_explicit(&s_seq, memory_order_acquire);
+        if (begin & 1) {
+            continue;   // writer on the other core is mid-update
+        }
+        memcpy(data, &s_data, sizeof(*data));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s_seq, memory_order_relaxed) == begin) {
+            return begin / 2;
+        }
+    }
+}
+
+#if CONFIG_WEATHER_SNAPSHOT_STRESS
+static const char *TAG = "snapshot";
+
+#define STRESS_PUBLISHES    200000
+
+static struct {
+    TaskHandle_t caller;
+    atomic_bool done;
+    unsigned reads;
+    unsigned torn;
+} s_stress;
+
+/* Publish n into every field of the first driver, with timestamp n */
+static void stress_writer_task(void *arg)
+{
+    const sensor_driver_t *driver = sensor_drivers[0];
+    sensor_message_t msg = { .type = 0 };
+
+    for (uint32_t n = 1; n <= STRESS_PUBLISHES; n++) {
+        for (int i = 0; i < driver->field_count; i++) {
+            memcpy((uint8_t *)&msg + driver->fields[i].offset, &n, sizeof(n));
+        }
+        weather_snapshot_publish(&msg, n);
+    }
+    atomic_store(&s_stress.done, true);
+    xTaskNotifyGive(s_stress.caller);
+    vTaskDelete(NULL);
+}
+
+/* A snapshot is whole if every field and the timestamp hold the same n, and
+ * n publishes have completed since the run started */
+static void stress_reader_task(void *arg)
+{
+    const sensor_driver_t *driver = sensor_drivers[0];
+    uint32_t base = *(uint32_t *)arg;
+    weather_data_t data;
+
+    while (!atomic_load(&s_stress.done)) {
+        uint32_t generation = weather_snapshot_read(&data) - base;
+        bool whole = data.timestamp == generation;
+        for (int i = 0; i < driver->field_count; i++) {
+            uint32_t value;
+            memcpy(&value, (uint8_t *)&data + driver->fields[i].snapshot_offset, sizeof(value));
+            whole &= value == generation;
+        }
+        if (!whole && s_stress.torn++ == 0) {
+            ESP_LOGE(TAG, "Torn snapshot after %lu publishes: timestamp %lld",
+                     (unsigned long)generation, (long long)data.timestamp);
+        }
+        s_stress.reads++;
+    }
+    xTaskNotifyGive(s_stress.caller);
+    vTaskDelete(NULL);
+}
+
+/* Publish from one task while another reads, on different cores where there
+   are two, and abort on any snapshot mixing two publishes. Runs before the
+   publisher starts and clears the snapshot afterwards. */
+void weather_snapshot_stress(void)
+{
+    weather_data_t data;
+    uint32_t base = weather_snapshot_read(&data);
+
+    s_stress.caller = xTaskGetCurrentTaskHandle();
+    xTaskCreatePinnedToCore(stress_reader_task, "snap_reader", 3072, &base, 5, NULL, 0);
+    xTaskCreatePinnedToCore(stress_writer_task, "snap_writer", 3072, NULL, 5, NULL, portNUM_PROCESSORS - 1);
+    ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+
+    taskENTER_CRITICAL(&s_write_lock);
+    unsigned seq = atomic_load_explicit(&s_seq, memory_order_relaxed);
+    atomic_store_explicit(&s_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memset(&s_data, 0, sizeof(s_data));
+    atomic_store_explicit(&s_seq, seq + 2, memory_order_release);
+    taskEXIT_CRITICAL(&s_write_lock);
+
+    if (s_stress.torn) {
+        ESP_LOGE(TAG, "%u of %u snapshots torn", s_stress.torn, s_stress.reads);
+        abort();
+    }
+    ESP_LOGI(TAG, "%d publishes, %u concurrent reads, none torn", STRESS_PUBLISHES, s_stress.reads);
+}
+#endif
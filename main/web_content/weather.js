@@ -1,5 +1,10 @@
-// Create WebSocket connection
-const socket = new WebSocket('ws://weather1.local/ws');
+// Binary telemetry unless the page is loaded with ?json
+const BINARY_SUBPROTOCOL = 'weather.bin.v2';
+const RECORD_SIZE = 36;
+const RECORD_REPLAY = 0x01;
+const params = new URLSearchParams(window.location.search);
+const useBinary = !params.has('json');
+
 const elements = {
     temperature: document.getElementById('temperature'),
     pressure: document.getElementById('pressure'),
@@ -8,45 +13,124 @@ const elements = {
     magnetic: document.getElementById('magnetic')
 };
 
+let socket = null;
+// Sequence number of the newest snapshot shown, to resume from after a reconnect
+let lastSeq = null;
+let reconnectDelay = 1000;
+
+// Create WebSocket connection
+function connect() {
+    socket = useBinary ?
+        new WebSocket(`ws://${window.location.host}/ws`, BINARY_SUBPROTOCOL) :
+        new WebSocket(`ws://${window.location.host}/ws`);
+    socket.binaryType = 'arraybuffer';
+    socket.addEventListener('open', onOpen);
+    socket.addEventListener('message', onMessage);
+    socket.addEventListener('error', (event) => {
+        console.error('WebSocket error:', event);
+    });
+    socket.addEventListener('close', onClose);
+}
+
 // Connection opened
-socket.addEventListener('open', (event) => {
-    sendToServer('data1');
+function onOpen(event) {
     console.log('Connected to WebSocket server');
-});
+    reconnectDelay = 1000;
+    // ?rate_ms=100&fields=pressure,heading asks for fewer or slower frames
+    const control = {};
+    if (params.has('rate_ms')) {
+        control.rate_ms = Number(params.get('rate_ms'));
+    }
+    if (params.has('fields')) {
+        control.fields = params.get('fields').split(',');
+    }
+    // After a reconnect, ask for what was missed
+    if (lastSeq !== null) {
+        control.resume = lastSeq;
+    }
+    if (Object.keys(control).length) {
+        sendToServer(JSON.stringify(control));
+    }
+}
 
 // Listen for messages from server
-socket.addEventListener('message', (event) => {
+function onMessage(event) {
     try {
+        if (event.data instanceof ArrayBuffer) {
+            for (let offset = 0; offset + RECORD_SIZE <= event.data.byteLength; offset += RECORD_SIZE) {
+                const record = decodeRecord(new DataView(event.data, offset, RECORD_SIZE));
+                showSnapshot(record, record.replay);
+            }
+            return;
+        }
         const data = JSON.parse(event.data);
-        updateReadings(data);
+        if ('rate_ms' in data) {
+            console.log('Subscribed:', data);
+        } else if (data.replay) {
+            console.log(`Replayed ${data.replay.length} snapshots, ${data.missed} missed`);
+            data.replay.forEach((snapshot) => showSnapshot(snapshot, true));
+        } else {
+            showSnapshot(data, false);
+        }
     } catch (e) {
         console.error('Error parsing websocket data:', e);
     }
-});
+}
 
-// Handle errors
-socket.addEventListener('error', (event) => {
-    console.error('WebSocket error:', event);
-});
+// Live frames always apply; replayed ones only if newer than what is shown,
+// as live frames may have overtaken them
+function showSnapshot(data, replayed) {
+    if (replayed && lastSeq !== null && data.seq <= lastSeq) {
+        return;
+    }
+    lastSeq = data.seq;
+    updateReadings(data);
+}
 
-// Connection closed
-socket.addEventListener('close', (event) => {
-    console.log('Disconnected from WebSocket server');
-    // Attempt to reconnect after 5 seconds
-    setTimeout(() => {
-        window.location.reload();
-    }, 5000);
-});
+// Connection closed: reconnect in place, backing off to 30 s
+function onClose(event) {
+    console.log(`Disconnected from WebSocket server, retrying in ${reconnectDelay / 1000} s`);
+    setTimeout(connect, reconnectDelay);
+    reconnectDelay = Math.min(reconnectDelay * 2, 30000);
+}
 
 // Function to send data to server
 function sendToServer(data) {
-    if (socket.readyState === WebSocket.OPEN) {
+    if (socket && socket.readyState === WebSocket.OPEN) {
         socket.send(data);
     } else {
         console.error('WebSocket is not open');
     }
 }
 
+connect();
+
+// Decode a binary telemetry record (ws_record_v2_t in web_server.c) into
+// the same shape as the JSON frame
+function decodeRecord(view) {
+    const version = view.getUint8(0);
+    if (version !== 2) {
+        throw new Error(`Unknown record version ${version}`);
+    }
+    const c = view.getFloat32(16, true);
+    const pa = view.getUint32(4, true);
+    const m = 44330 * (1 - Math.pow(pa / 101325, 0.190295));
+    return {
+        seq: view.getUint32(32, true),
+        replay: (view.getUint8(1) & RECORD_REPLAY) !== 0,
+        timestamp: Number(view.getBigInt64(8, true)),
+        temperature: { c: c, f: c * 9 / 5 + 32 },
+        pressure: { pa: pa, inhg: pa / 3386 },
+        altitude: { m: m, ft: m * 3.281 },
+        heading: view.getUint16(2, true),
+        magnetic: {
+            x: view.getFloat32(20, true),
+            y: view.getFloat32(24, true),
+            z: view.getFloat32(28, true)
+        }
+    };
+}
+
 function updateReadings(data) {
     if (data.temperature) {
         elements.temperature.textContent = 
@@ -60,7 +144,7 @@ function updateReadings(data) {
         elements.altitude.textContent = 
             `Altitude: ${data.altitude.m.toFixed(1)} m, ${data.altitude.ft.toFixed(0)} ft`;
     }
-    if (data.heading) {
+    if (data.heading !== undefined) {
         elements.heading.textContent = 
             `Heading: ${Math.round(data.heading)} degrees`;
     }
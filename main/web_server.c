@@ -6,10 +6,19 @@
 #include "esp_system.h"
 #include "esp_check.h"
 #include "esp_http_server.h"
+#if !CONFIG_IDF_TARGET_LINUX
 #include "esp_wifi.h"
+#endif
 
+#include <stdatomic.h>
+
+#include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "esp_timer.h"
+#include <sys/select.h>
+#if CONFIG_WEATHER_JSON_BENCHMARK
 #include "cJSON.h"
+#endif
 
 #include "weather.h"
 
@@ -17,68 +26,914 @@ static const char *TAG = "web_server";
 
 // Functions for web socket handling
 httpd_handle_t server;
-int client_fd;
 
-// callback function to be put onto httpd work queue
-static void ws_async_send(void *arg)
+// One session context slot per socket the server will hold open
+#define WEB_MAX_SESSIONS    7
+// Largest text frame a client may send
+#define WS_RX_MAX           128
+#define ASSET_UPLOAD_CHUNK  4096    // bytes of an asset bundle upload per flash write
+
+/* Opt-in binary telemetry. A client that asks for this subprotocol at the
+ * upgrade gets one ws_record_v2_t per frame instead of JSON, and a replay
+ * as several records back to back. Derived units (F, inHg, altitude, feet)
+ * are left to the browser. Version 2 added the sequence number. */
+#define WS_SUBPROTOCOL_BINARY "weather.bin.v2"
+#define WS_RECORD_VERSION   2
+#define WS_RECORD_REPLAY    0x01    // flags: from the history, not live
+
+// Little-endian on the wire, as both the ESP32 and the host are
+typedef struct __attribute__((packed)) {
+    uint8_t version;        // WS_RECORD_VERSION
+    uint8_t flags;          // WS_RECORD_*
+    uint16_t heading;       // degrees
+    uint32_t pressure;      // Pa
+    int64_t timestamp;      // us since boot of the latest reading
+    float temperature;      // degC
+    float x, y, z;          // mG
+    uint32_t seq;           // see history.c
+} ws_record_v2_t;
+_Static_assert(sizeof(ws_record_v2_t) == 36, "ws_record_v2_t must match weather.js");
+
+static size_t build_binary_frame(const weather_data_t *data, uint32_t seq, uint8_t flags,
+                                 uint8_t *buf, size_t size)
+{
+    ws_record_v2_t record = {
+        .version = WS_RECORD_VERSION,
+        .flags = flags,
+        .heading = data->angle,
+        .pressure = data->pressure,
+        .timestamp = data->timestamp,
+        .temperature = data->temperature,
+        .x = data->x,
+        .y = data->y,
+        .z = data->z,
+        .seq = seq,
+    };
+    if (size < sizeof(record)) {
+        return 0;
+    }
+    memcpy(buf, &record, sizeof(record));
+    return sizeof(record);
+}
+
+// Room for the largest telemetry frame
+#define WS_FRAME_MAX        256
+
+// Every field, for a client that has not had a frame yet
+#define WS_FIELDS_ALL       UINT32_MAX
+#define WS_FIELDS_MAGNETIC  (WEATHER_FIELD_BIT(x) | WEATHER_FIELD_BIT(y) | WEATHER_FIELD_BIT(z))
+
+// Groups of the JSON frame a client can subscribe to by name
+static const struct {
+    const char *name;
+    uint32_t fields;
+} s_ws_groups[] = {
+    { "temperature", WEATHER_FIELD_BIT(temperature) },
+    { "pressure", WEATHER_FIELD_BIT(pressure) },
+    { "altitude", WEATHER_FIELD_BIT(altitude) },
+    { "heading", WEATHER_FIELD_BIT(angle) },
+    { "magnetic", WS_FIELDS_MAGNETIC },
+};
+#define WS_GROUPS           (int)(sizeof(s_ws_groups) / sizeof(s_ws_groups[0]))
+
+/* The groups holding a field in changed (WEATHER_FIELD_BIT()s), as members
+ * of the current object */
+static void json_add_groups(json_writer_t *w, const weather_data_t *data, uint32_t changed)
+{
+    if (changed & WEATHER_FIELD_BIT(temperature)) {
+        json_object_begin(w, "temperature");
+        json_add_fixed(w, "c", data->temperature, 2);
+        json_add_fixed(w, "f", (data->temperature * 9.0f / 5.0f) + 32, 2);
+        json_object_end(w);
+    }
+
+    if (changed & WEATHER_FIELD_BIT(pressure)) {
+        json_object_begin(w, "pressure");
+        json_add_int(w, "pa", data->pressure);
+        json_add_fixed(w, "inhg", data->pressure / 3386.0f, 3);
+        json_object_end(w);
+    }
+
+    if (changed & WEATHER_FIELD_BIT(altitude)) {
+        json_object_begin(w, "altitude");
+        json_add_fixed(w, "m", data->altitude, 2);
+        json_add_fixed(w, "ft", data->altitude * 3.281f, 1);
+        json_object_end(w);
+    }
+
+    if (changed & WEATHER_FIELD_BIT(angle)) {
+        json_add_int(w, "heading", data->angle);
+    }
+
+    if (changed & WS_FIELDS_MAGNETIC) {
+        json_object_begin(w, "magnetic");
+        json_add_fixed(w, "x", data->x, 2);
+        json_add_fixed(w, "y", data->y, 2);
+        json_add_fixed(w, "z", data->z, 2);
+        json_object_end(w);
+    }
+}
+
+static void json_add_telemetry(json_writer_t *w, const char *key, const weather_data_t *data,
+                               uint32_t seq, uint32_t changed)
 {
-    ESP_LOGD(TAG, "ws_async_send with arg = %p. client_fd = %d", arg, client_fd);
+    json_object_begin(w, key);
+    json_add_uint(w, "seq", seq);
+    json_add_groups(w, data, changed);
+    json_object_end(w);
+}
+
+/* The JSON frame for one snapshot. Returns its length, or 0 if it did not
+ * fit. */
+static size_t build_json_frame(const weather_data_t *data, uint32_t seq, uint32_t changed, char *buf, size_t size)
+{
+    json_writer_t w;
+    json_writer_init(&w, buf, size);
+    json_add_telemetry(&w, NULL, data, seq, changed);
+    return json_writer_finish(&w) ? w.len : 0;
+}
+
+/* The /api/current body: every field with the sequence number and the us
+ * since boot of the latest reading */
+static size_t build_current_json(const weather_data_t *data, uint32_t seq, char *buf, size_t size)
+{
+    json_writer_t w;
+    json_writer_init(&w, buf, size);
+    json_object_begin(&w, NULL);
+    json_add_uint(&w, "seq", seq);
+    json_add_int64(&w, "timestamp", data->timestamp);
+    json_add_groups(&w, data, WS_FIELDS_ALL);
+    json_object_end(&w);
+    return json_writer_finish(&w) ? w.len : 0;
+}
 
-    // Create JSON object
+#if CONFIG_WEATHER_JSON_BENCHMARK
+static unsigned s_cjson_allocs;
+
+static void *counting_malloc(size_t size)
+{
+    s_cjson_allocs++;
+    return malloc(size);
+}
+
+/* The frame as it used to be built, for comparison */
+static size_t build_cjson_frame(const weather_data_t *data, char *buf, size_t size)
+{
     cJSON *root = cJSON_CreateObject();
-    
-    // Add sensor data from weather_data structure
+
     cJSON *temp = cJSON_CreateObject();
-    cJSON_AddNumberToObject(temp, "c", weather_data.temperature);
-    cJSON_AddNumberToObject(temp, "f", (weather_data.temperature * 9.0/5.0) + 32);
+    cJSON_AddNumberToObject(temp, "c", data->temperature);
+    cJSON_AddNumberToObject(temp, "f", (data->temperature * 9.0/5.0) + 32);
     cJSON_AddItemToObject(root, "temperature", temp);
 
     cJSON *pressure = cJSON_CreateObject();
-    cJSON_AddNumberToObject(pressure, "pa", weather_data.pressure);
-    cJSON_AddNumberToObject(pressure, "inhg", weather_data.pressure / 3386.0);
+    cJSON_AddNumberToObject(pressure, "pa", data->pressure);
+    cJSON_AddNumberToObject(pressure, "inhg", data->pressure / 3386.0);
     cJSON_AddItemToObject(root, "pressure", pressure);
 
     cJSON *altitude = cJSON_CreateObject();
-    cJSON_AddNumberToObject(altitude, "m", weather_data.altitude);
-    cJSON_AddNumberToObject(altitude, "ft", weather_data.altitude * 3.281);
+    cJSON_AddNumberToObject(altitude, "m", data->altitude);
+    cJSON_AddNumberToObject(altitude, "ft", data->altitude * 3.281);
     cJSON_AddItemToObject(root, "altitude", altitude);
 
-    cJSON_AddNumberToObject(root, "heading", weather_data.angle);
+    cJSON_AddNumberToObject(root, "heading", data->angle);
 
     cJSON *magnetic = cJSON_CreateObject();
-    cJSON_AddNumberToObject(magnetic, "x", weather_data.x);
-    cJSON_AddNumberToObject(magnetic, "y", weather_data.y);
-    cJSON_AddNumberToObject(magnetic, "z", weather_data.z);
+    cJSON_AddNumberToObject(magnetic, "x", data->x);
+    cJSON_AddNumberToObject(magnetic, "y", data->y);
+    cJSON_AddNumberToObject(magnetic, "z", data->z);
     cJSON_AddItemToObject(root, "magnetic", magnetic);
 
-    // Convert to string
     char *json_string = cJSON_PrintUnformatted(root);
-    
-    // Send via websocket
-    httpd_ws_frame_t ws_pkt;
-    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-    ws_pkt.payload = (uint8_t*)json_string;
-    ws_pkt.len = strlen(json_string);
-    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
+    size_t len = snprintf(buf, size, "%s", json_string);
+    cJSON_Delete(root);
+    cJSON_free(json_string);
+    return len;
+}
 
-    esp_err_t ret = httpd_ws_send_frame_async(server, client_fd, &ws_pkt);
-    ESP_LOGD(TAG, "httpd_ws_send_frame_async returned %d", (int)ret);
+/* Frames per second and heap allocations per frame, cJSON against the
+ * streaming writer */
+void web_json_benchmark(void)
+{
+    const int frames = 2000;
+    const weather_data_t data = {
+        .temperature = 18.1, .pressure = 101244, .altitude = 6.8,
+        .angle = 81, .x = -26.3, .y = -179.6, .z = -328.5,
+    };
+    char buf[WS_FRAME_MAX];
 
-    cJSON_Delete(root);
-    free(json_string);
+    cJSON_Hooks hooks = { .malloc_fn = counting_malloc, .free_fn = free };
+    cJSON_InitHooks(&hooks);
+    s_cjson_allocs = 0;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < frames; i++) {
+        build_cjson_frame(&data, buf, sizeof(buf));
+    }
+    int64_t cjson_us = esp_timer_get_time() - start;
+    cJSON_InitHooks(NULL);
+    ESP_LOGI(TAG, "cJSON: %lld frames/s, %u allocations/frame: %s",
+             frames * 1000000LL / cjson_us, s_cjson_allocs / frames, buf);
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < frames; i++) {
+        build_json_frame(&data, i, WS_FIELDS_ALL, buf, sizeof(buf));
+    }
+    int64_t writer_us = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "writer: %lld frames/s, 0 allocations/frame: %s",
+             frames * 1000000LL / writer_us, buf);
+}
+#endif // CONFIG_WEATHER_JSON_BENCHMARK
+
+/* Outgoing telemetry frames, shared by every client queue they sit in; the
+ * last reference returns a frame to the pool. The publisher task builds
+ * the frames most clients want: the binary record, the changed fields and
+ * all fields. Frames for other field subscriptions are built on the httpd
+ * task, once per distinct set of fields, and cached in the tick. The worst
+ * case is every queue full of distinct frames while WS_TICKS ticks are in
+ * flight and one of them is being sent. The /api/current body is a pool
+ * frame too: one per tick and the one being served. */
+typedef struct {
+    atomic_uint refs;
+    uint8_t type;           // httpd_ws_type_t
+    uint16_t len;
+    uint8_t data[WS_FRAME_MAX];
+} ws_frame_t;
+
+// JSON frames one tick can need: changed fields, all fields, one per client
+#define WS_TICK_JSON        (2 + WEB_MAX_SESSIONS)
+
+typedef struct {
+    atomic_bool busy;       // queued to the httpd task
+    uint32_t seq;           // history sequence number of the snapshot
+    uint32_t changed;       // fields changed since the last tick
+    weather_data_t data;    // snapshot the frames are built from
+    ws_frame_t *binary;
+    ws_frame_t *current;    // /api/current body, handed over to s_current
+    unsigned json_count;
+    struct {
+        uint32_t fields;
+        ws_frame_t *frame;  // NULL if it could not be built
+    } json[WS_TICK_JSON];
+} ws_tick_t;
+
+#define WS_TICKS            2
+#define WS_QUEUE_DEPTH      CONFIG_WEATHER_WS_QUEUE_DEPTH
+#define WS_FRAME_POOL       (WEB_MAX_SESSIONS * WS_QUEUE_DEPTH + WS_TICKS * 4 + WEB_MAX_SESSIONS + 1)
+// Slowest publish rate a client may ask for
+#define WS_RATE_MAX_MS      60000
+
+static ws_frame_t s_ws_frames[WS_FRAME_POOL];
+static ws_tick_t s_ws_ticks[WS_TICKS];
+
+/* The latest /api/current body and its ETag. Only the httpd task swaps
+ * them, in ws_async_send(), and the requests run there too, so a body
+ * never changes while it is being sent. */
+static ws_frame_t *s_current;
+static char s_current_etag[16];
+
+static ws_frame_t *ws_frame_alloc(void)
+{
+    for (int i = 0; i < WS_FRAME_POOL; i++) {
+        unsigned free_refs = 0;
+        if (atomic_compare_exchange_strong(&s_ws_frames[i].refs, &free_refs, 1)) {
+            return &s_ws_frames[i];
+        }
+    }
+    return NULL;
+}
+
+static void ws_frame_put(ws_frame_t *frame)
+{
+    if (frame) {
+        atomic_fetch_sub(&frame->refs, 1);
+    }
+}
+
+/* Build one encoding of the snapshot into a pool frame, JSON with the
+ * groups holding a field in fields */
+static ws_frame_t *ws_frame_build(const weather_data_t *data, uint32_t seq, bool binary, uint32_t fields)
+{
+    ws_frame_t *frame = ws_frame_alloc();
+    if (frame == NULL) {
+        ESP_LOGE(TAG, "No free telemetry frame");
+        return NULL;
+    }
+    size_t len;
+    if (binary) {
+        frame->type = HTTPD_WS_TYPE_BINARY;
+        len = build_binary_frame(data, seq, 0, frame->data, sizeof(frame->data));
+    } else {
+        frame->type = HTTPD_WS_TYPE_TEXT;
+        len = build_json_frame(data, seq, fields, (char *)frame->data, sizeof(frame->data));
+    }
+    if (len == 0) {
+        ESP_LOGE(TAG, "Telemetry frame does not fit in %d bytes", WS_FRAME_MAX);
+        ws_frame_put(frame);
+        return NULL;
+    }
+    frame->len = len;
+    return frame;
+}
+
+/* The /api/current body for the snapshot in a pool frame, serialized once
+ * per sample however many clients poll */
+static ws_frame_t *ws_current_build(const weather_data_t *data, uint32_t seq)
+{
+    ws_frame_t *frame = ws_frame_alloc();
+    if (frame == NULL) {
+        return NULL;
+    }
+    frame->len = build_current_json(data, seq, (char *)frame->data, sizeof(frame->data));
+    if (frame->len == 0) {
+        ws_frame_put(frame);
+        return NULL;
+    }
+    return frame;
+}
+
+/* The tick's JSON frame for a set of fields, built on first use */
+static ws_frame_t *ws_tick_json(ws_tick_t *tick, uint32_t fields)
+{
+    for (unsigned i = 0; i < tick->json_count; i++) {
+        if (tick->json[i].fields == fields) {
+            return tick->json[i].frame;
+        }
+    }
+    ws_frame_t *frame = ws_frame_build(&tick->data, tick->seq, false, fields);
+    if (tick->json_count < WS_TICK_JSON) {
+        tick->json[tick->json_count].fields = fields;
+        tick->json[tick->json_count].frame = frame;
+        tick->json_count++;
+    } else {
+        ws_frame_put(frame);    // not reached, every client has its own slot
+        frame = NULL;
+    }
+    return frame;
+}
+
+static void ws_tick_release(ws_tick_t *tick)
+{
+    ws_frame_put(tick->binary);
+    tick->binary = NULL;
+    ws_frame_put(tick->current);
+    tick->current = NULL;
+    for (unsigned i = 0; i < tick->json_count; i++) {
+        ws_frame_put(tick->json[i].frame);
+    }
+    tick->json_count = 0;
+    atomic_store(&tick->busy, false);
+}
+
+/* Per subscriber state, hung on the socket's sess_ctx at the WebSocket
+ * upgrade or the /events request so the server releases it when the
+ * socket closes. The queue holds frames the socket had no room for yet;
+ * when it is full the oldest goes, so a client on a poor link falls behind
+ * instead of holding up the httpd task for everyone. All use is on the
+ * httpd task. */
+typedef struct {
+    bool used;
+    bool binary;            // negotiated WS_SUBPROTOCOL_BINARY
+    bool sse;               // Server-Sent Events on /events rather than a WebSocket
+    bool synced;            // has had a complete JSON frame, deltas from now on
+    int fd;
+    uint32_t fields;        // JSON groups subscribed to, WEATHER_FIELD_BIT()s
+    uint32_t pending;       // fields changed since its last frame
+    uint32_t rate_ms;       // least time between frames, 0 for every tick
+    int64_t last_sent;      // time its last frame was queued
+    uint8_t head;           // oldest queued frame
+    uint8_t count;
+    uint8_t max_count;      // high-water mark of count
+    uint32_t sent;
+    uint32_t dropped;
+    ws_frame_t *queue[WS_QUEUE_DEPTH];
+} ws_client_t;
+
+static ws_client_t s_ws_clients[WEB_MAX_SESSIONS];
+
+static void ws_client_drop_oldest(ws_client_t *client)
+{
+    ws_frame_put(client->queue[client->head]);
+    client->head = (client->head + 1) % WS_QUEUE_DEPTH;
+    client->count--;
+}
+
+static void ws_client_free(void *ctx)
+{
+    ws_client_t *client = ctx;
+    while (client->count) {
+        ws_client_drop_oldest(client);
+    }
+    client->used = false;
+}
+
+static ws_client_t *ws_client_alloc(int fd)
+{
+    for (int i = 0; i < WEB_MAX_SESSIONS; i++) {
+        if (!s_ws_clients[i].used) {
+            s_ws_clients[i] = (ws_client_t) { .used = true, .fd = fd, .fields = WS_FIELDS_ALL };
+            return &s_ws_clients[i];
+        }
+    }
+    return NULL;
+}
+
+static void ws_client_push(ws_client_t *client, ws_frame_t *frame)
+{
+    atomic_fetch_add(&frame->refs, 1);
+    client->queue[(client->head + client->count) % WS_QUEUE_DEPTH] = frame;
+    if (++client->count > client->max_count) {
+        client->max_count = client->count;
+    }
+}
+
+/* True if a send on fd would not block */
+static bool ws_writable(int fd)
+{
+    fd_set fds;
+    struct timeval now = { 0 };
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    return select(fd + 1, NULL, &fds, NULL, &now) > 0;
+}
+
+/* Send all of buf on a socket of the server */
+static esp_err_t sse_send(int fd, const void *buf, size_t len)
+{
+    while (len) {
+        int sent = httpd_socket_send(server, fd, buf, len, 0);
+        if (sent <= 0) {
+            return ESP_FAIL;
+        }
+        buf = (const uint8_t *)buf + sent;
+        len -= sent;
+    }
+    return ESP_OK;
+}
+
+/* One telemetry frame as an SSE event, in a chunk of the chunked response */
+static esp_err_t sse_send_event(int fd, const ws_frame_t *frame)
+{
+    static const char data[] = "data: ";
+    static const char tail[] = "\n\n\r\n";    // end of event, end of chunk
+    char head[16];
+    int len = snprintf(head, sizeof(head), "%x\r\n%s",
+                       (unsigned)(sizeof(data) - 1 + frame->len + 2), data);
+    esp_err_t ret = sse_send(fd, head, len);
+    if (ret == ESP_OK) {
+        ret = sse_send(fd, frame->data, frame->len);
+    }
+    if (ret == ESP_OK) {
+        ret = sse_send(fd, tail, sizeof(tail) - 1);
+    }
+    return ret;
+}
+
+/* Send queued frames for as long as the socket takes them */
+static void ws_client_flush(ws_client_t *client)
+{
+    while (client->count && ws_writable(client->fd)) {
+        ws_frame_t *frame = client->queue[client->head];
+        esp_err_t ret;
+        if (client->sse) {
+            ret = sse_send_event(client->fd, frame);
+        } else {
+            httpd_ws_frame_t ws_pkt = {
+                .type = frame->type,
+                .payload = frame->data,
+                .len = frame->len,
+            };
+            ret = httpd_ws_send_frame_async(server, client->fd, &ws_pkt);
+        }
+        if (ret != ESP_OK) {
+            // Peer gone without a close frame, have the server reap it
+            ESP_LOGW(TAG, "Sending to client %d failed with %d, closing it", client->fd, ret);
+            httpd_sess_trigger_close(server, client->fd);
+            return;
+        }
+        ws_client_drop_oldest(client);
+        client->sent++;
+    }
+}
+
+/* The subscriber on a socket, or NULL if it has none. Sockets of other
+ * requests can carry a session context of their own. */
+static ws_client_t *ws_client_get(int fd)
+{
+    ws_client_t *client = httpd_sess_get_ctx(server, fd);
+    uintptr_t addr = (uintptr_t)client;
+    if (addr < (uintptr_t)s_ws_clients || addr >= (uintptr_t)(s_ws_clients + WEB_MAX_SESSIONS)) {
+        return NULL;
+    }
+    if (!client->sse && httpd_ws_get_fd_info(server, fd) != HTTPD_WS_CLIENT_WEBSOCKET) {
+        return NULL;
+    }
+    return client;
+}
+
+/* Callback function to be put onto httpd work queue with a ws_tick_t. Each
+ * client collects the changed fields until its rate allows a frame, then
+ * gets the ones it subscribed to; a JSON client not yet in sync gets all
+ * of its fields. The binary record is fixed size and always complete. */
+static void ws_async_send(void *arg)
+{
+    ws_tick_t *tick = arg;
+    int64_t now = esp_timer_get_time();
+
+    if (tick->current) {
+        ws_frame_put(s_current);
+        s_current = tick->current;
+        tick->current = NULL;
+        snprintf(s_current_etag, sizeof(s_current_etag), "\"%u\"", (unsigned)tick->seq);
+    }
+
+    size_t fds = WEB_MAX_SESSIONS;
+    int client_fds[WEB_MAX_SESSIONS];
+    if (httpd_get_client_list(server, &fds, client_fds) != ESP_OK) {
+        fds = 0;
+    }
+
+    for (size_t i = 0; i < fds; i++) {
+        ws_client_t *client = ws_client_get(client_fds[i]);
+        if (client == NULL) {
+            continue;
+        }
+
+        client->pending |= tick->changed;
+        if (client->rate_ms && now - client->last_sent < client->rate_ms * 1000LL) {
+            continue;
+        }
+        uint32_t fields = client->synced ? client->pending & client->fields : client->fields;
+        if (fields == 0 && !client->binary) {
+            continue;   // nothing it subscribed to has changed
+        }
+
+        if (client->count == WS_QUEUE_DEPTH) {
+            // Make room; a JSON client then needs every field again
+            ws_client_drop_oldest(client);
+            client->dropped++;
+            client->synced = false;
+            fields = client->fields;
+        }
+
+        ws_frame_t *frame = client->binary ? tick->binary : ws_tick_json(tick, fields);
+        if (frame == NULL) {
+            client->dropped++;
+            continue;
+        }
+        ws_client_push(client, frame);
+        client->synced = true;
+        client->pending = 0;
+        client->last_sent = now;
+        ws_client_flush(client);
+    }
+
+    ws_tick_release(tick);
+}
+
+/* Apply a control message such as
+ *   {"rate_ms":100,"fields":["pressure","heading"],"resume":1234}
+ * Any member may be left out; an empty field list means all of them.
+ * resume, the last sequence number the client saw before it reconnected,
+ * is returned in *resume. Returns false if the message has none of them. */
+static bool ws_client_control(ws_client_t *client, const char *msg, uint32_t *resume)
+{
+    bool found = false;
+
+    const char *r = strstr(msg, "\"resume\"");
+    if (r && (r = strchr(r, ':'))) {
+        *resume = strtoul(r + 1, NULL, 10);
+        found = true;
+    }
+
+    const char *p = strstr(msg, "\"rate_ms\"");
+    if (p && (p = strchr(p, ':'))) {
+        long rate = strtol(p + 1, NULL, 10);
+        client->rate_ms = rate < 0 ? 0 : rate > WS_RATE_MAX_MS ? WS_RATE_MAX_MS : rate;
+        found = true;
+    }
+
+    const char *end = NULL;
+    p = strstr(msg, "\"fields\"");
+    if (p && (p = strchr(p, '[')) && (end = strchr(p, ']'))) {
+        uint32_t fields = 0;
+        // Each quoted name in the list
+        for (const char *name = strchr(p, '"'); name && name < end; name = strchr(name + 1, '"')) {
+            const char *close = strchr(name + 1, '"');
+            if (close == NULL || close > end) {
+                break;
+            }
+            size_t len = close - name - 1;
+            for (int i = 0; i < WS_GROUPS; i++) {
+                if (strlen(s_ws_groups[i].name) == len && strncmp(name + 1, s_ws_groups[i].name, len) == 0) {
+                    fields |= s_ws_groups[i].fields;
+                }
+            }
+            name = close;
+        }
+        client->fields = fields ? fields : WS_FIELDS_ALL;
+        client->synced = false;     // send the newly subscribed fields next
+        found = true;
+    }
+    return found;
+}
+
+// Largest replay frame
+#define WS_REPLAY_MAX       4096
+
+/* Send a reconnected client the snapshots after seq last from the history,
+ * as one frame: records back to back, or {"replay":[...],"missed":n}. When
+ * more were missed than fit, the newest are sent; a binary client sees the
+ * gap in the record seqs. */
+static esp_err_t ws_send_replay(httpd_req_t *req, const ws_client_t *client, uint32_t last)
+{
+    static uint8_t buf[WS_REPLAY_MAX];
+    uint32_t newest = history_newest();
+    if (last > newest) {
+        last = 0;               // the station restarted since, send what there is
+    }
+    if (last == newest) {
+        return ESP_OK;
+    }
+
+    uint32_t fit = client->binary ? WS_REPLAY_MAX / sizeof(ws_record_v2_t) : WS_REPLAY_MAX / WS_FRAME_MAX - 1;
+    uint32_t count = newest - last;
+    if (count > CONFIG_WEATHER_HISTORY_DEPTH) {
+        count = CONFIG_WEATHER_HISTORY_DEPTH;
+    }
+    if (count > fit) {
+        count = fit;
+    }
+    uint32_t missed = newest - last - count;
+
+    httpd_ws_frame_t ws_pkt = { .payload = buf };
+    weather_data_t data;
+    if (client->binary) {
+        ws_pkt.type = HTTPD_WS_TYPE_BINARY;
+        for (uint32_t seq = newest - count + 1; seq <= newest; seq++) {
+            if (history_get(seq, &data)) {
+                ws_pkt.len += build_binary_frame(&data, seq, WS_RECORD_REPLAY, buf + ws_pkt.len,
+                                                 sizeof(buf) - ws_pkt.len);
+            } else {
+                missed++;       // overwritten while we were at it
+            }
+        }
+    } else {
+        json_writer_t w;
+        json_writer_init(&w, (char *)buf, sizeof(buf));
+        json_object_begin(&w, NULL);
+        json_array_begin(&w, "replay");
+        for (uint32_t seq = newest - count + 1; seq <= newest; seq++) {
+            if (history_get(seq, &data)) {
+                json_add_telemetry(&w, NULL, &data, seq, client->fields);
+            } else {
+                missed++;       // overwritten while we were at it
+            }
+        }
+        json_array_end(&w);
+        json_add_uint(&w, "missed", missed);
+        json_object_end(&w);
+        if (!json_writer_finish(&w)) {
+            ESP_LOGE(TAG, "Replay does not fit in %d bytes", WS_REPLAY_MAX);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        ws_pkt.type = HTTPD_WS_TYPE_TEXT;
+        ws_pkt.len = w.len;
+    }
+    ESP_LOGI(TAG, "Replaying %u snapshots to client %d, %u missed", (unsigned)count,
+             client->fd, (unsigned)missed);
+    return httpd_ws_send_frame(req, &ws_pkt);
+}
+
+/* Write a client's settings, as the reply to a control message and in the
+ * client list */
+static void ws_client_settings(json_writer_t *w, const ws_client_t *client)
+{
+    json_add_int(w, "rate_ms", client->rate_ms);
+    json_array_begin(w, "fields");
+    for (int i = 0; i < WS_GROUPS; i++) {
+        if ((client->fields & s_ws_groups[i].fields) == s_ws_groups[i].fields) {
+            json_add_string(w, NULL, s_ws_groups[i].name);
+        }
+    }
+    json_array_end(w);
+}
+
+/* The latest snapshot as JSON, for scripts that poll. The body was built
+ * once when the sample came in, so a request costs a header lookup and the
+ * socket write; a poller that sends back the ETag (the sequence number)
+ * gets a 304 until there is a new sample. */
+static esp_err_t current_get_handler(httpd_req_t *req)
+{
+    if (s_current == NULL) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "No reading yet");
+    }
+
+    httpd_resp_set_hdr(req, "ETag", s_current_etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    char header[64];
+    esp_err_t ret = httpd_req_get_hdr_value_str(req, "If-None-Match", header, sizeof(header));
+    if ((ret == ESP_OK || ret == ESP_ERR_HTTPD_RESULT_TRUNC) && strstr(header, s_current_etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, (const char *)s_current->data, s_current->len);
+}
+
+// Largest /api/history entry: every channel's min, max, mean and count
+#define TS_ENTRY_MAX        (48 + WEATHER_CHANNELS * 96)
+#define TS_CHUNK            (4 * TS_ENTRY_MAX)
+
+/* The time-series rollups, oldest first, for trend charts:
+ * ?res=raw|minute|hour&count=N, by default the last hour's minutes. The
+ * store keeps them up to date as readings come in, so this only copies
+ * the slots out, a chunk at a time. Times are us since boot of the start
+ * of each second, minute or hour; "now" gives the reference. */
+static esp_err_t trends_get_handler(httpd_req_t *req)
+{
+    char query[48];
+    char value[16];
+    bool raw = false;
+    ts_rollup_t rollup = TS_MINUTE;
+    unsigned long count = 60;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "res", value, sizeof(value)) == ESP_OK) {
+            if (strcmp(value, "raw") == 0) {
+                raw = true;
+            } else if (strcmp(value, "hour") == 0) {
+                rollup = TS_HOUR;
+            } else if (strcmp(value, "minute") != 0) {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "res is raw, minute or hour");
+            }
+        }
+        if (httpd_query_key_value(query, "count", value, sizeof(value)) == ESP_OK) {
+            count = strtoul(value, NULL, 10);
+        }
+    }
+
+    uint32_t newest = raw ? timeseries_raw_newest() : timeseries_newest(rollup);
+    unsigned depth = raw ? CONFIG_WEATHER_TS_RAW_SECONDS : timeseries_depth(rollup);
+    int64_t interval_us = raw ? 1000000 : timeseries_interval_us(rollup);
+    if (count > depth) {
+        count = depth;
+    }
+    if (count > newest) {
+        count = newest;
+    }
+
+    static char buf[TS_CHUNK];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf));
+    json_object_begin(&w, NULL);
+    json_add_string(&w, "resolution", raw ? "raw" : rollup == TS_HOUR ? "hour" : "minute");
+    json_add_uint(&w, "interval", interval_us / 1000000);
+    json_add_int64(&w, "now", esp_timer_get_time());
+    json_array_begin(&w, "samples");
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    for (uint32_t seq = newest - count + 1; seq <= newest && count > 0; seq++) {
+        float values[WEATHER_CHANNELS];
+        ts_stat_t stats[WEATHER_CHANNELS];
+        if (raw ? !timeseries_raw_get(seq, values) : !timeseries_get(rollup, seq, stats)) {
+            continue;   // nothing in that period, or overwritten meanwhile
+        }
+        json_object_begin(&w, NULL);
+        json_add_int64(&w, "t", (seq - 1) * interval_us);
+        for (int i = 0; i < WEATHER_CHANNELS; i++) {
+            const char *name = timeseries_channel_name(i);
+            if (name == NULL) {
+                continue;
+            }
+            if (raw) {
+                json_add_fixed(&w, name, values[i], 2);     // null if not read
+            } else if (stats[i].count) {
+                json_object_begin(&w, name);
+                json_add_fixed(&w, "min", stats[i].min, 2);
+                json_add_fixed(&w, "max", stats[i].max, 2);
+                json_add_fixed(&w, "mean", stats[i].mean, 2);
+                json_add_uint(&w, "count", stats[i].count);
+                json_object_end(&w);
+            }
+        }
+        json_object_end(&w);
+
+        if (w.len > sizeof(buf) - TS_ENTRY_MAX) {
+            if (httpd_resp_send_chunk(req, buf, w.len) != ESP_OK) {
+                return ESP_FAIL;
+            }
+            w.len = 0;      // carry on where the chunk ended
+        }
+    }
+    json_array_end(&w);
+    json_object_end(&w);
+    if (httpd_resp_send_chunk(req, buf, w.len) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* Queue depth and drop counts of each WebSocket client */
+static esp_err_t ws_clients_get_handler(httpd_req_t *req)
+{
+    static char buf[128 + WEB_MAX_SESSIONS * 192];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf));
+    json_object_begin(&w, NULL);
+    publisher_stats_t stats;
+    publisher_get_stats(&stats);
+    json_object_begin(&w, "publisher");
+    json_add_int(&w, "depth", stats.depth);
+    json_add_int(&w, "max_queued", stats.max_queued);
+    json_add_int(&w, "dropped", stats.dropped);
+    json_object_end(&w);
+    json_add_int(&w, "depth", WS_QUEUE_DEPTH);
+    json_array_begin(&w, "clients");
+    for (int i = 0; i < WEB_MAX_SESSIONS; i++) {
+        const ws_client_t *client = &s_ws_clients[i];
+        if (!client->used) {
+            continue;
+        }
+        json_object_begin(&w, NULL);
+        json_add_int(&w, "fd", client->fd);
+        json_add_string(&w, "encoding", client->binary ? WS_SUBPROTOCOL_BINARY : client->sse ? "sse" : "json");
+        json_add_int(&w, "queued", client->count);
+        json_add_int(&w, "max_queued", client->max_count);
+        json_add_int(&w, "sent", client->sent);
+        json_add_int(&w, "dropped", client->dropped);
+        ws_client_settings(&w, client);
+        json_object_end(&w);
+    }
+    json_array_end(&w);
+    json_object_end(&w);
+    if (!json_writer_finish(&w)) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    }
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, buf, w.len);
+}
+
+/* Server-Sent Events: the same telemetry as the JSON WebSocket, for
+ * clients such as curl that have no WebSocket stack. The handler sends the
+ * headers and leaves the chunked response open; from then on the socket
+ * is a subscriber like any other, fed from the same shared frames, queue
+ * and drop policy, each frame going out as one "data:" event in a chunk.
+ *
+ * Cost per client, against a JSON WebSocket:
+ * - RAM: the same ws_client_t slot (about 50 bytes plus 4 per queued
+ *   frame) and no frame copies, as both reference the shared frames. The
+ *   lwIP socket and httpd session dominate either way.
+ * - CPU: no extra encoding; each frame takes three socket writes (chunk
+ *   head, frame, chunk tail) where a WebSocket takes two (frame header,
+ *   payload), and about 12 more bytes on the wire.
+ * - No control messages: every field, on every tick. */
+static esp_err_t events_get_handler(httpd_req_t *req)
+{
+    ws_client_t *client = ws_client_alloc(httpd_req_to_sockfd(req));
+    if (client == NULL) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No free client slot");
+    }
+    client->sse = true;
+    // The server frees any context an earlier request on this socket left
+    req->sess_ctx = client;
+    req->free_ctx = ws_client_free;
+
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    static const char retry[] = "retry: 5000\n\n";
+    ESP_LOGI(TAG, "Event stream client %d", client->fd);
+    return httpd_resp_send_chunk(req, retry, sizeof(retry) - 1);
 }
 
 static esp_err_t ws_data_handler(httpd_req_t *req)
 {
     if (req->method == HTTP_GET) {
-         return ESP_OK;
+        // Handshake done, subscribe the socket with the encoding it asked for
+        char protocol[32];
+        ws_client_t *client = ws_client_alloc(httpd_req_to_sockfd(req));
+        ESP_RETURN_ON_FALSE(client, ESP_ERR_NO_MEM, TAG, "No free WebSocket client slot");
+        client->binary = httpd_req_get_hdr_value_str(req, "Sec-WebSocket-Protocol", protocol, sizeof(protocol)) == ESP_OK &&
+                         strcmp(protocol, WS_SUBPROTOCOL_BINARY) == 0;
+        // The server frees any context an earlier request on this socket left
+        req->sess_ctx = client;
+        req->free_ctx = ws_client_free;
+        ESP_LOGI(TAG, "WebSocket client %d using %s", httpd_req_to_sockfd(req),
+                 client->binary ? WS_SUBPROTOCOL_BINARY : "JSON");
+        return ESP_OK;
     }
 
-    client_fd = httpd_req_to_sockfd(req);
-    ESP_LOGI(TAG, "ws_data_handler set client_fd %d", client_fd);
+    ESP_LOGI(TAG, "ws_data_handler frame from %d", httpd_req_to_sockfd(req));
 
     httpd_ws_frame_t ws_pkt;
+#if CONFIG_WEATHER_STATIC_ALLOC
+    static uint8_t buf[WS_RX_MAX + 1];
+#else
     uint8_t *buf = NULL;
+#endif
     memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
     ws_pkt.type = HTTPD_WS_TYPE_TEXT;
     /* Set max_len = 0 to get the frame len */
@@ -87,41 +942,107 @@ static esp_err_t ws_data_handler(httpd_req_t *req)
         ESP_LOGE(TAG, "httpd_ws_recv_frame failed to get frame len with %d", ret);
         return ret;
     }
-    ESP_LOGI(TAG, "frame len is %d", ws_pkt.len);
+    ESP_LOGI(TAG, "frame len is %u", (unsigned)ws_pkt.len);
+    if (ws_pkt.len > WS_RX_MAX) {
+        ESP_LOGE(TAG, "frame of %u bytes is too long", (unsigned)ws_pkt.len);
+        return ESP_ERR_INVALID_SIZE;
+    }
     if (ws_pkt.len) {
+#if CONFIG_WEATHER_STATIC_ALLOC
+        memset(buf, 0, ws_pkt.len + 1);
+#else
         /* ws_pkt.len + 1 is for NULL termination as we are expecting a string */
         buf = calloc(1, ws_pkt.len + 1);
         if (buf == NULL) {
             ESP_LOGE(TAG, "Failed to calloc memory for buf");
             return ESP_ERR_NO_MEM;
         }
+#endif
         ws_pkt.payload = buf;
         /* Set max_len = ws_pkt.len to get the frame payload */
         ret = httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
         if (ret != ESP_OK) {
             ESP_LOGE(TAG, "httpd_ws_recv_frame failed with %d", ret);
+#if !CONFIG_WEATHER_STATIC_ALLOC
             free(buf);
+#endif
             return ret;
         }
         ESP_LOGI(TAG, "Got packet with message: %s", ws_pkt.payload);
     }
     ESP_LOGI(TAG, "Packet type: %d", ws_pkt.type);
 
-    ret = httpd_ws_send_frame(req, &ws_pkt);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "httpd_ws_send_frame failed with %d", ret);
+    // Control messages are answered with the settings now in force, and
+    // a resume with what the client missed
+    ws_client_t *client = req->sess_ctx;
+    uint32_t resume = 0;
+    if (ws_pkt.type == HTTPD_WS_TYPE_TEXT && ws_pkt.len && client &&
+        ws_client_control(client, (const char *)ws_pkt.payload, &resume)) {
+        char reply[128];
+        json_writer_t w;
+        json_writer_init(&w, reply, sizeof(reply));
+        json_object_begin(&w, NULL);
+        ws_client_settings(&w, client);
+        json_object_end(&w);
+        json_writer_finish(&w);
+        ws_pkt.payload = (uint8_t *)reply;
+        ws_pkt.len = w.len < sizeof(reply) ? w.len : 0;
+        ret = httpd_ws_send_frame(req, &ws_pkt);
+        if (ret == ESP_OK && resume) {
+            ret = ws_send_replay(req, client, resume);
+        }
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "httpd_ws_send_frame failed with %d", ret);
+        }
+    } else {
+        ESP_LOGW(TAG, "Ignoring message that is not a control message");
     }
+#if !CONFIG_WEATHER_STATIC_ALLOC
     free(buf);
+#endif
     return ret;
 }
 
 
 // Functions to implement web pages
+#if CONFIG_WEATHER_STATIC_ALLOC
+/* Session accumulators come from a fixed pool. The handlers and the free
+ * function all run on the httpd task, so the pool needs no lock. */
+static struct {
+    int value;
+    bool used;
+} s_sessions[WEB_MAX_SESSIONS];
+#endif
+
+/* Function to allocate context */
+static int *adder_alloc(void)
+{
+#if CONFIG_WEATHER_STATIC_ALLOC
+    for (int i = 0; i < WEB_MAX_SESSIONS; i++) {
+        if (!s_sessions[i].used) {
+            s_sessions[i].used = true;
+            return &s_sessions[i].value;
+        }
+    }
+    return NULL;
+#else
+    return malloc(sizeof(int));
+#endif
+}
+
 /* Function to free context */
 static void adder_free_func(void *ctx)
 {
     ESP_LOGI(TAG, "/ Free Context function called");
+#if CONFIG_WEATHER_STATIC_ALLOC
+    for (int i = 0; i < WEB_MAX_SESSIONS; i++) {
+        if (ctx == &s_sessions[i].value) {
+            s_sessions[i].used = false;
+        }
+    }
+#else
     free(ctx);
+#endif
 }
 
 /* This handler keeps accumulating data that is posted to it into a per
@@ -153,7 +1074,7 @@ static esp_err_t weather_post_handler(httpd_req_t *req)
     /* Create session's context if not already available */
     if (! req->sess_ctx) {
         ESP_LOGI(TAG, "/ allocating new session");
-        req->sess_ctx = malloc(sizeof(int));
+        req->sess_ctx = adder_alloc();
         ESP_RETURN_ON_FALSE(req->sess_ctx, ESP_ERR_NO_MEM, TAG, "Failed to allocate sess_ctx");
         req->free_ctx = adder_free_func;
         *(int *)req->sess_ctx = 0;
@@ -171,37 +1092,166 @@ static esp_err_t weather_post_handler(httpd_req_t *req)
 
 #include "web_content.h"
 
-/* This handler gets the present value of the accumulator */
+/* The asset at a URL path of len bytes, or NULL: from the assets partition
+ * if it has one, else built in. html_to_c.py picked WEB_ASSET_HASH_SEED so
+ * that every path has a slot to itself, so this is one hash and one
+ * compare whatever the number of assets. */
+static const web_asset_t *web_asset_find(const char *path, size_t len)
+{
+    const web_asset_t *stored = asset_store_find(path, len);
+    if (stored) {
+        return stored;
+    }
+    uint32_t hash = web_asset_hash(path, len, WEB_ASSET_HASH_SEED);
+    int index = web_asset_slots[hash & ((1u << WEB_ASSET_HASH_BITS) - 1)];
+    if (index < 0) {
+        return NULL;
+    }
+    const web_asset_t *asset = &web_assets[index];
+    return strncmp(asset->path, path, len) == 0 && asset->path[len] == '\0' ? asset : NULL;
+}
+
+/* Whether an Accept-Encoding header lists the given content coding */
+static bool accepts_encoding(const char *header, const char *coding)
+{
+    size_t len = strlen(coding);
+    for (const char *p = strstr(header, coding); p; p = strstr(p + 1, coding)) {
+        if ((p == header || p[-1] == ' ' || p[-1] == ',') && strchr(" ,;", p[len])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Send an asset, in the smallest encoding the client takes. The lengths
+ * and ETags come from html_to_c.py or the bundle, so nothing is measured or
+ * hashed per request, and a bundle asset goes to the socket straight from
+ * mapped flash. A client that already has the representation gets a
+ * bodiless 304. no-cache has browsers revalidate every load, as the URLs
+ * stay the same across firmware updates. */
+static esp_err_t send_asset(httpd_req_t *req, const web_asset_t *asset)
+{
+    char header[128];
+    const web_variant_t *variant = &asset->raw;
+    const char *encoding = NULL;
+
+    // A longer header is truncated, which still finds an early match
+    esp_err_t ret = httpd_req_get_hdr_value_str(req, "Accept-Encoding", header, sizeof(header));
+    if (ret == ESP_OK || ret == ESP_ERR_HTTPD_RESULT_TRUNC) {
+        if (asset->br.data && accepts_encoding(header, "br")) {
+            variant = &asset->br;
+            encoding = "br";
+        } else if (asset->gz.data && accepts_encoding(header, "gzip")) {
+            variant = &asset->gz;
+            encoding = "gzip";
+        }
+    }
+
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    httpd_resp_set_hdr(req, "ETag", variant->etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    ret = httpd_req_get_hdr_value_str(req, "If-None-Match", header, sizeof(header));
+    if ((ret == ESP_OK || ret == ESP_ERR_HTTPD_RESULT_TRUNC) && strstr(header, variant->etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    httpd_resp_set_type(req, asset->type);
+    if (encoding) {
+        httpd_resp_set_hdr(req, "Content-Encoding", encoding);
+    }
+    return httpd_resp_send(req, (const char *)variant->data, variant->len);
+}
+
+/* Every GET the other handlers leave: an embedded asset or 404 */
 static esp_err_t weather_get_handler(httpd_req_t *req)
 {
     /* Log total visitors */
     unsigned *visitors = (unsigned *)req->user_ctx;
     ESP_LOGI(TAG, "/ visitor count = %d", ++(*visitors));
 
-    /* Create session's context if not already available */
-    if (! req->sess_ctx) {
-        ESP_LOGI(TAG, "/ GET allocating new session");
-        req->sess_ctx = malloc(sizeof(int));
-        ESP_RETURN_ON_FALSE(req->sess_ctx, ESP_ERR_NO_MEM, TAG, "Failed to allocate sess_ctx");
-        req->free_ctx = adder_free_func;
-        *(int *)req->sess_ctx = 0;
+    ESP_LOGI(TAG, "/ GET handler send %s", req->uri);
+
+    // The path without any query, such as ?json
+    const web_asset_t *asset = web_asset_find(req->uri, strcspn(req->uri, "?#"));
+    if (asset == NULL) {
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
     }
-    ESP_LOGI(TAG, "/ GET handler send index_page");
+    return send_asset(req, asset);
+}
 
-    if (strcmp(req->uri, "/weather.css") == 0) {
-        httpd_resp_set_type(req, "text/css");
-        httpd_resp_send(req, css__weather, HTTPD_RESP_USE_STRLEN);
-        return ESP_OK;
+#if CONFIG_WEATHER_ASSET_UPLOAD
+/* Whether the request carries CONFIG_WEATHER_ASSET_UPLOAD_TOKEN as a bearer
+ * token. The compare takes the same time wherever the first difference is. */
+static bool upload_authorized(httpd_req_t *req)
+{
+    static const char token[] = CONFIG_WEATHER_ASSET_UPLOAD_TOKEN;
+    static const char prefix[] = "Bearer ";
+    char header[sizeof(prefix) + sizeof(token)];
+
+    if (sizeof(token) == 1 ||
+        httpd_req_get_hdr_value_str(req, "Authorization", header, sizeof(header)) != ESP_OK ||
+        strlen(header) != sizeof(prefix) - 1 + sizeof(token) - 1 ||
+        strncmp(header, prefix, sizeof(prefix) - 1) != 0) {
+        return false;
     }
-    if (strcmp(req->uri, "/weather.js") == 0) {
-        httpd_resp_set_type(req, "text/javascript");
-        httpd_resp_send(req, js__weather, HTTPD_RESP_USE_STRLEN);
-        return ESP_OK;
-    }    
+    unsigned char diff = 0;
+    for (size_t i = 0; i < sizeof(token) - 1; i++) {
+        diff |= header[sizeof(prefix) - 1 + i] ^ token[i];
+    }
+    return diff == 0;
+}
 
-    httpd_resp_send(req, html__index, HTTPD_RESP_USE_STRLEN);
-    return ESP_OK;
+/* Replace the asset bundle with the request body, a bundle built by
+ * host/pack_assets.py. It is written to flash as it arrives, then checked
+ * against its SHA-256 before it is served; a bundle that fails leaves the
+ * built-in assets in use. Nothing is erased until the upload token checks. */
+static esp_err_t assets_put_handler(httpd_req_t *req)
+{
+    if (!upload_authorized(req)) {
+        ESP_LOGW(TAG, "Asset upload without a valid token refused");
+        httpd_resp_set_hdr(req, "WWW-Authenticate", "Bearer");
+        return httpd_resp_send_err(req, HTTPD_401_UNAUTHORIZED, "Upload token required");
+    }
+
+    esp_err_t ret = asset_store_begin(req->content_len);
+    if (ret != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                   ret == ESP_ERR_NOT_FOUND ? "No assets partition" : "Bad bundle size");
+    }
+
+    char *buf = malloc(ASSET_UPLOAD_CHUNK);
+    ESP_RETURN_ON_FALSE(buf, ESP_ERR_NO_MEM, TAG, "No memory for the upload buffer");
+    size_t left = req->content_len;
+    while (left > 0 && ret == ESP_OK) {
+        int len = httpd_req_recv(req, buf, left < ASSET_UPLOAD_CHUNK ? left : ASSET_UPLOAD_CHUNK);
+        if (len == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (len <= 0) {
+            ret = ESP_FAIL;
+            break;
+        }
+        ret = asset_store_write(buf, len);
+        left -= len;
+    }
+    free(buf);
+
+    // Checks the bundle, or drops what was written of it
+    esp_err_t check = asset_store_finish();
+    if (ret == ESP_FAIL) {
+        return ESP_FAIL;    // connection lost, nobody to answer
+    }
+    if (ret != ESP_OK || check != ESP_OK) {
+        ESP_LOGW(TAG, "Asset upload rejected: %s", esp_err_to_name(ret != ESP_OK ? ret : check));
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                   check == ESP_ERR_INVALID_CRC ? "Bundle fails its integrity check" : "Bad bundle");
+    }
+    ESP_LOGI(TAG, "Asset bundle of %u bytes installed", (unsigned)req->content_len);
+    return httpd_resp_sendstr(req, "OK");
 }
+#endif // CONFIG_WEATHER_ASSET_UPLOAD
 
 #if CONFIG_EXAMPLE_SESSION_CTX_HANDLERS
 // login and logout handler are created to test the server functionality to delete the older sess_ctx if it is changed from another handler.
@@ -271,7 +1321,7 @@ static esp_err_t weather_put_handler(httpd_req_t *req)
     /* Create session's context if not already available */
     if (! req->sess_ctx) {
         ESP_LOGI(TAG, "/ PUT allocating new session");
-        req->sess_ctx = malloc(sizeof(int));
+        req->sess_ctx = adder_alloc();
         ESP_RETURN_ON_FALSE(req->sess_ctx, ESP_ERR_NO_MEM, TAG, "Failed to allocate sess_ctx");
         req->free_ctx = adder_free_func;
     }
@@ -294,26 +1344,18 @@ static const httpd_uri_t weather_post = {
     .user_ctx = &visitors
 };
 
-static const httpd_uri_t weather_get = {
-    .uri      = "/",
-    .method   = HTTP_GET,
-    .handler  = weather_get_handler,
-    .user_ctx = &visitors
-};
-static const httpd_uri_t weather_get2 = {
-    .uri      = "/index.html",
-    .method   = HTTP_GET,
-    .handler  = weather_get_handler,
-    .user_ctx = &visitors
-};
-static const httpd_uri_t weather_get3 = {
-    .uri      = "/weather.css",
-    .method   = HTTP_GET,
-    .handler  = weather_get_handler,
-    .user_ctx = &visitors
+#if CONFIG_WEATHER_ASSET_UPLOAD
+static const httpd_uri_t assets_put = {
+    .uri      = "/api/assets",
+    .method   = HTTP_PUT,
+    .handler  = assets_put_handler,
+    .user_ctx = NULL
 };
-static const httpd_uri_t weather_get4 = {
-    .uri      = "/weather.js",
+#endif
+
+// Registered last, so /ws, /events and /api/ match first
+static const httpd_uri_t weather_get = {
+    .uri      = "/*",
     .method   = HTTP_GET,
     .handler  = weather_get_handler,
     .user_ctx = &visitors
@@ -323,9 +1365,38 @@ static const httpd_uri_t websocket = {
         .method     = HTTP_GET,
         .handler    = ws_data_handler,
         .user_ctx   = NULL,
-        .is_websocket = true
+        .is_websocket = true,
+        .supported_subprotocol = WS_SUBPROTOCOL_BINARY
+};
+
+
+static const httpd_uri_t events_get = {
+    .uri      = "/events",
+    .method   = HTTP_GET,
+    .handler  = events_get_handler,
+    .user_ctx = NULL
 };
 
+static const httpd_uri_t current_get = {
+    .uri      = "/api/current",
+    .method   = HTTP_GET,
+    .handler  = current_get_handler,
+    .user_ctx = NULL
+};
+
+static const httpd_uri_t trends_get = {
+    .uri      = "/api/history",
+    .method   = HTTP_GET,
+    .handler  = trends_get_handler,
+    .user_ctx = NULL
+};
+
+static const httpd_uri_t ws_clients_get = {
+    .uri      = "/api/clients",
+    .method   = HTTP_GET,
+    .handler  = ws_clients_get_handler,
+    .user_ctx = NULL
+};
 
 #if CONFIG_EXAMPLE_SESSION_CTX_HANDLERS
 static const httpd_uri_t login = {
@@ -351,6 +1422,8 @@ static const httpd_uri_t weather_put = {
 };
 
 httpd_handle_t start_webserver(void);
+
+#if !CONFIG_IDF_TARGET_LINUX
 static esp_err_t stop_webserver(httpd_handle_t server);
 
 static void disconnect_handler(void* arg, esp_event_base_t event_base,
@@ -376,34 +1449,46 @@ static void connect_handler(void* arg, esp_event_base_t event_base,
         *server = start_webserver();
     }
 }
+#endif // !CONFIG_IDF_TARGET_LINUX
 
 httpd_handle_t start_webserver(void)
 {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    
+    config.server_port = CONFIG_WEATHER_HTTP_PORT;
+    config.max_open_sockets = WEB_MAX_SESSIONS;
+    config.max_uri_handlers = 12;
+    // One "/*" handler serves all the embedded assets
+    config.uri_match_fn = httpd_uri_match_wildcard;
+
     // Start the httpd server
     ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
 
     if (httpd_start(&server, &config) == ESP_OK) {
+#if !CONFIG_IDF_TARGET_LINUX
         /* Register event handlers to stop the server when Wi-Fi or Ethernet is disconnected,
         * and re-start it upon connection.
         */
         ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &connect_handler, &server));
         ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &disconnect_handler, &server));
+#endif
     
         // Set URI handlers
         ESP_LOGI(TAG, "Registering URI handlers");
         httpd_register_uri_handler(server, &websocket);
-        httpd_register_uri_handler(server, &weather_get);
-        httpd_register_uri_handler(server, &weather_get2);
-        httpd_register_uri_handler(server, &weather_get3);
-        httpd_register_uri_handler(server, &weather_get4);                
+        httpd_register_uri_handler(server, &events_get);
+        httpd_register_uri_handler(server, &current_get);
+        httpd_register_uri_handler(server, &trends_get);
+        httpd_register_uri_handler(server, &ws_clients_get);
+#if CONFIG_WEATHER_ASSET_UPLOAD
+        httpd_register_uri_handler(server, &assets_put);
+#endif
 #if CONFIG_EXAMPLE_SESSION_CTX_HANDLERS
         httpd_register_uri_handler(server, &login);
         httpd_register_uri_handler(server, &logout);
 #endif // CONFIG_EXAMPLE_SESSION_CTX_HANDLERS
         httpd_register_uri_handler(server, &weather_put);
         httpd_register_uri_handler(server, &weather_post);
+        httpd_register_uri_handler(server, &weather_get);
 
         return server;
     }
@@ -412,18 +1497,57 @@ httpd_handle_t start_webserver(void)
     return NULL;
 }
 
+#if !CONFIG_IDF_TARGET_LINUX
 static esp_err_t stop_webserver(httpd_handle_t server)
 {
     esp_err_t ret = httpd_stop(server);
     server = NULL;
     return ret;
 }
+#endif
 
-// Add function to send sensor data
-esp_err_t send_sensor_data(sensor_message_t *msg)
+/* Serialize the snapshot for the WebSocket clients, on the publisher task,
+ * and queue the sending to the httpd task. changed is the mask of fields
+ * changed since the last call. Returns ESP_ERR_NO_MEM while earlier ticks
+ * are still in flight, so the caller can carry the changes over. */
+esp_err_t send_sensor_data(uint32_t changed)
 {
-    if (server && client_fd) {
-        return httpd_queue_work(server, ws_async_send, NULL);
+    ws_tick_t *tick = NULL;
+    for (int i = 0; server && i < WS_TICKS && tick == NULL; i++) {
+        if (!atomic_exchange(&s_ws_ticks[i].busy, true)) {
+            tick = &s_ws_ticks[i];
+        }
+    }
+    if (server && tick == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Take one consistent copy of the readings for the whole tick, and keep
+    // it for replay whether or not the server is up
+    weather_data_t data;
+    weather_snapshot_read(&data);
+    uint32_t seq = history_append(&data);
+    if (tick == NULL) {
+        return ESP_FAIL;
     }
-    return ESP_FAIL;
-}
\ No newline at end of file
+    tick->data = data;
+    tick->seq = seq;
+    tick->changed = changed;
+    tick->binary = ws_frame_build(&tick->data, seq, true, 0);
+    tick->current = ws_current_build(&tick->data, seq);
+    ws_tick_json(tick, changed);
+    ws_tick_json(tick, WS_FIELDS_ALL);
+
+    // The control socket datagram is an lwIP allocation
+#if CONFIG_WEATHER_ALLOC_CHECK
+    alloc_check_exempt(true);
+#endif
+    esp_err_t ret = httpd_queue_work(server, ws_async_send, tick);
+#if CONFIG_WEATHER_ALLOC_CHECK
+    alloc_check_exempt(false);
+#endif
+    if (ret != ESP_OK) {
+        ws_tick_release(tick);
+    }
+    return ret;
+}
@@ -0,0 +1,14 @@
+/* Network bring-up for the host (linux target) build
+
+   The host already has a network; the web server binds to it directly, so
+   there is no Wi-Fi station or mDNS responder to start.
+*/
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "wifi station";
+
+void wifi_init_sta(void)
+{
+    ESP_LOGI(TAG, "Host build, using the host network. Dashboard at http://localhost:%d/", CONFIG_WEATHER_HTTP_PORT);
+}